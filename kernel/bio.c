@@ -12,6 +12,11 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// A block of file data written before the file system has
+// chosen a disk block for it is kept in a delayed buffer,
+// named by its inode and block number in the file instead
+// of by disk block number, and pinned until fs.c flushes it.
 
 
 #include "types.h"
@@ -22,6 +27,7 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "iosched.h"
 
 struct {
   struct spinlock lock;
@@ -31,6 +37,7 @@ struct {
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+  int ndelay;  // delayed buffers
 } bcache;
 
 void
@@ -64,7 +71,7 @@ bget(uint dev, uint blockno)
 
   // Is the block already cached?
   for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
+    if(b->ip == 0 && b->dev == dev && b->blockno == blockno){
       b->refcnt++;
       release(&bcache.lock);
       acquiresleep(&b->lock);
@@ -88,6 +95,17 @@ bget(uint dev, uint blockno)
   panic("bget: no buffers");
 }
 
+// Read or write b through the disk request queue.
+static void
+brw(struct buf *b, int write)
+{
+  struct ioreq r;
+
+  iostart(&r, b->dev, b->blockno, write);
+  virtio_disk_rw(b, write);
+  iodone(&r);
+}
+
 // Return a locked buf with the contents of the indicated block.
 struct buf*
 bread(uint dev, uint blockno)
@@ -96,19 +114,48 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    brw(b, 0);
     b->valid = 1;
   }
   return b;
 }
 
+// Return a locked buf for the indicated block without reading
+// it, for a caller that will overwrite all of it.
+struct buf*
+bblank(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->valid = 1;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  brw(b, 1);
+}
+
+// Write the contents of b[i] to disk block blockno[i], for i
+// in 0..n-1, all together; the bufs must be locked. The disk
+// gets runs of consecutive block numbers as single requests.
+void
+bwritev(struct buf **b, uint *blockno, int n)
+{
+  struct ioreq r;
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&b[i]->lock))
+      panic("bwritev");
+  iostart(&r, b[0]->dev, blockno[0], 1);
+  virtio_disk_writev(b, blockno, n);
+  iodone(&r);
 }
 
 // Release a locked buffer.
@@ -150,4 +197,81 @@ bunpin(struct buf *b) {
   release(&bcache.lock);
 }
 
+// Return the locked delayed buffer for block fbn of ip, or 0
+// if there's none. If alloc is set and there's room, make
+// one, with valid clear.
+struct buf*
+bdelay(struct inode *ip, uint fbn, int alloc)
+{
+  struct buf *b;
 
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->ip == ip && b->fbn == fbn){
+      b->refcnt++;
+      release(&bcache.lock);
+      acquiresleep(&b->lock);
+      return b;
+    }
+  }
+  if(alloc && bcache.ndelay < NDELAY){
+    for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+      if(b->refcnt == 0) {
+        b->dev = 0;
+        b->blockno = 0;
+        b->ip = ip;
+        b->fbn = fbn;
+        b->valid = 0;
+        b->refcnt = 2;  // one for the caller, one to pin it
+        bcache.ndelay++;
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
+    }
+  }
+  release(&bcache.lock);
+  return 0;
+}
+
+// Return the locked delayed buffer of ip with the
+// lowest block number, or 0 if there's none.
+struct buf*
+bdelayfirst(struct inode *ip)
+{
+  struct buf *b, *first;
+
+  acquire(&bcache.lock);
+  first = 0;
+  for(b = bcache.head.next; b != &bcache.head; b = b->next)
+    if(b->ip == ip && (first == 0 || b->fbn < first->fbn))
+      first = b;
+  if(first == 0){
+    release(&bcache.lock);
+    return 0;
+  }
+  first->refcnt++;
+  release(&bcache.lock);
+  acquiresleep(&first->lock);
+  return first;
+}
+
+// b, which the caller holds locked, has been written
+// elsewhere or discarded; unpin it for reuse.
+void
+bundelay(struct buf *b)
+{
+  acquire(&bcache.lock);
+  b->ip = 0;
+  b->valid = 0;
+  b->refcnt--;
+  bcache.ndelay--;
+  release(&bcache.lock);
+}
+
+// Number of delayed buffers; racy, for deciding when to flush.
+int
+bdelaycount(void)
+{
+  return bcache.ndelay;
+}
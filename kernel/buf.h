@@ -3,6 +3,8 @@ struct buf {
   int disk;    // does disk "own" buf?
   uint dev;
   uint blockno;
+  struct inode *ip; // if delayed: the file this is block fbn of,
+  uint fbn;         // which has no disk block for it yet
   struct sleeplock lock;
   uint refcnt;
   struct buf *prev; // LRU cache list
@@ -0,0 +1,199 @@
+// Directory entry cache.
+//
+// Remembers the results of dirlookup(): which inode a name in a
+// directory refers to, or that the name isn't there (a negative
+// entry, inum 0). Entries are found by hashing the directory's
+// device and inode number with the name, and the least recently
+// used entry is recycled when the cache is full.
+//
+// Callers hold the directory's inode lock, which keeps lookups
+// and changes to one directory's entries in order. dirlink()
+// and unlink update the cache as they change a directory, and
+// iput() purges a directory's entries when it frees the inode.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NDCACHE 128  // entries
+#define NDHASH  61   // hash chains
+
+struct dentry {
+  uint dev;
+  uint dir;            // inum of the directory
+  char name[DIRSIZ];
+  uint inum;           // 0 if the name isn't in the directory
+  uint off;            // byte offset of the entry in the directory
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list, most recently used first
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDCACHE];
+  struct dentry *hash[NDHASH];
+  struct dentry head;
+  uint hits;           // lookups answered with an inode
+  uint neghits;        // lookups answered "not there"
+  uint misses;
+} dcache;
+
+void
+dcacheinit(void)
+{
+  struct dentry *e;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(e = dcache.ent; e < dcache.ent+NDCACHE; e++){
+    e->next = dcache.head.next;
+    e->prev = &dcache.head;
+    dcache.head.next->prev = e;
+    dcache.head.next = e;
+  }
+}
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + name[i];
+  return h % NDHASH;
+}
+
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *e;
+
+  for(e = dcache.hash[dhash(dev, dir, name)]; e; e = e->hnext)
+    if(e->dev == dev && e->dir == dir && namecmp(name, e->name) == 0)
+      return e;
+  return 0;
+}
+
+// move e to the front of the LRU list.
+static void
+dtouch(struct dentry *e)
+{
+  e->next->prev = e->prev;
+  e->prev->next = e->next;
+  e->next = dcache.head.next;
+  e->prev = &dcache.head;
+  dcache.head.next->prev = e;
+  dcache.head.next = e;
+}
+
+// take e off its hash chain, if it's on one.
+static void
+dunhash(struct dentry *e)
+{
+  struct dentry **pp;
+
+  if(e->dir == 0)
+    return;
+  for(pp = &dcache.hash[dhash(e->dev, e->dir, e->name)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == e){
+      *pp = e->hnext;
+      break;
+    }
+  }
+  e->dir = 0;
+}
+
+// Look up name in directory dir on dev.
+// Returns 1 and sets *inum and *off if the name is cached
+// as present, 0 if it's cached as absent, -1 if not cached.
+int
+dcache_lookup(uint dev, uint dir, char *name, uint *inum, uint *off)
+{
+  struct dentry *e;
+  int r;
+
+  acquire(&dcache.lock);
+  if((e = dfind(dev, dir, name)) == 0){
+    dcache.misses++;
+    r = -1;
+  } else if(e->inum == 0){
+    dcache.neghits++;
+    dtouch(e);
+    r = 0;
+  } else {
+    dcache.hits++;
+    *inum = e->inum;
+    *off = e->off;
+    dtouch(e);
+    r = 1;
+  }
+  release(&dcache.lock);
+  return r;
+}
+
+// Record that name in directory dir on dev refers to inum,
+// in the entry at byte offset off, or, if inum is 0,
+// that there's no such name.
+void
+dcache_enter(uint dev, uint dir, char *name, uint inum, uint off)
+{
+  struct dentry *e;
+  uint h;
+
+  acquire(&dcache.lock);
+  if((e = dfind(dev, dir, name)) == 0){
+    e = dcache.head.prev;
+    dunhash(e);
+    e->dev = dev;
+    e->dir = dir;
+    strncpy(e->name, name, DIRSIZ);
+    h = dhash(dev, dir, name);
+    e->hnext = dcache.hash[h];
+    dcache.hash[h] = e;
+  }
+  e->inum = inum;
+  e->off = off;
+  dtouch(e);
+  release(&dcache.lock);
+}
+
+// Forget all the entries of directory dir on dev,
+// which is being freed.
+void
+dcache_purge(uint dev, uint dir)
+{
+  struct dentry *e;
+
+  acquire(&dcache.lock);
+  for(e = dcache.ent; e < dcache.ent+NDCACHE; e++){
+    if(e->dir == dir && e->dev == dev){
+      dunhash(e);
+      // recycle it first.
+      e->next->prev = e->prev;
+      e->prev->next = e->next;
+      e->prev = dcache.head.prev;
+      e->next = &dcache.head;
+      dcache.head.prev->next = e;
+      dcache.head.prev = e;
+    }
+  }
+  release(&dcache.lock);
+}
+
+// Copy the hit, negative hit and miss counts to st[0..2].
+void
+dcache_stat(uint *st)
+{
+  acquire(&dcache.lock);
+  st[0] = dcache.hits;
+  st[1] = dcache.neghits;
+  st[2] = dcache.misses;
+  release(&dcache.lock);
+}
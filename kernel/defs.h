@@ -2,6 +2,10 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct ioreq;
+struct iostat;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -12,10 +16,16 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bblank(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, uint*, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+struct buf*     bdelay(struct inode*, uint, int);
+struct buf*     bdelayfirst(struct inode*);
+void            bundelay(struct buf*);
+int             bdelaycount(void);
 
 // console.c
 void            consoleinit(void);
@@ -25,21 +35,40 @@ void            consputc(int);
 // exec.c
 int             exec(char*, char**);
 
+// dcache.c
+void            dcacheinit(void);
+int             dcache_lookup(uint, uint, char*, uint*, uint*);
+void            dcache_enter(uint, uint, char*, uint, uint);
+void            dcache_purge(uint, uint);
+void            dcache_stat(uint*);
+
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
+int             filegetdents(struct file*, uint64, int n);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             fileseek(struct file*, int, int);
+int             filesend(struct file*, struct file*, int);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filewritev(struct file*, struct iovec*, int, int);
 
 // fs.c
-void            fsinit(int);
+int             fsinit(int);
+void            flusher(void);
+int             iflush(struct inode*);
+int             dirempty(struct inode*);
+int             mount(uint, struct inode*);
+int             ismountpoint(struct inode*);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+void            dirunlink(struct inode*, char*, uint);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
+struct inode*   iget(uint, uint);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -50,6 +79,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+int             copyi(struct inode*, uint, struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -59,22 +89,49 @@ void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// iosched.c
+void            ioschedinit(void);
+void            iostart(struct ioreq*, uint, uint, int);
+void            iodone(struct ioreq*);
+int             iosched(int);
+void            iostat(struct iostat*);
+
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_order(int);
+void*           kalloc_zeroed(void);
+void            kalloc_idle(void);
 void            kfree(void *);
+void            kfree_order(void *, int);
 void            kinit(void);
+void            kmemstat(int*);
+int             kfreepages(void);
+void            kzero(void);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
 
 // log.c
-void            initlog(int, struct superblock*);
+int             initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            log_sync(void);
+void            log_stat(uint*);
+void            log_write_data(struct buf*);
+void            log_free(int, uint);
+int             log_reusable(int, uint);
+extern int      maxopblocks;
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -89,6 +146,10 @@ int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
+uint64          proc_satp(struct proc *);
+void            proc_unmapped(struct proc *, uint64, uint64);
+void            proc_switchpt(struct proc *);
+void            proc_switchkpt(void);
 int             kill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
@@ -100,6 +161,7 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kthread(void (*)(void), char *);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
@@ -107,6 +169,10 @@ int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
+// copyuser.S
+int             copyuser(char *, char *, uint64);
+int             copyuserstr(char *, char *, uint64);
+
 // swtch.S
 void            swtch(struct context*, struct context*);
 
@@ -118,6 +184,15 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// swap.c
+void            swapinit(uint, uint);
+int             swapout(void);
+void            swapreserve(int);
+void*           kalloc_user(void);
+uint64          swapin(pagetable_t, uint64);
+void            swapread(pte_t, void*);
+void            swapfree(pte_t);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -168,11 +243,14 @@ int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+void            uvmguard(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             kvmshare(pagetable_t, uint64);
+void            kvmunshare(pagetable_t);
 
 // plic.c
 void            plicinit(void);
@@ -183,7 +261,11 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
-void            virtio_disk_intr(void);
+void            virtio_disk_rwpage(uint, void *, int);
+void            virtio_disk_writev(struct buf **, uint *, int);
+int             virtio_disk_poll(int, int);
+void            virtio_disk_intr(int);
+int             virtio_disk_present(uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
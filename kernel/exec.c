@@ -83,7 +83,13 @@ exec(char *path, char **argv)
   if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE, PTE_W)) == 0)
     goto bad;
   sz = sz1;
+#ifdef SUMCOPY
+  // copyuser() can reach pages that aren't PTE_U, so
+  // there mustn't be a page there at all.
+  uvmguard(pagetable, sz-2*PGSIZE);
+#else
   uvmclear(pagetable, sz-2*PGSIZE);
+#endif
   sp = sz;
   stackbase = sp - PGSIZE;
 
@@ -123,9 +129,16 @@ exec(char *path, char **argv)
   // Commit to the user image.
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  p->asid = 0;  // TLB entries under the old ASID describe the old image.
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+#ifdef SUMCOPY
+  // the kernel is running on the old page table.
+  push_off();
+  proc_switchpt(p);
+  pop_off();
+#endif
   proc_freepagetable(oldpagetable, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
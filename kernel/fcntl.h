@@ -3,3 +3,16 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+// lseek() whence
+#define SEEK_SET  0
+#define SEEK_CUR  1
+#define SEEK_END  2
+
+// a buffer for readv() and writev()
+struct iovec {
+  void *iov_base;
+  uint iov_len;
+};
+
+#define IOV_MAX   16  // most buffers readv() and writev() take
@@ -11,18 +11,20 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "stat.h"
+#include "fcntl.h"
 #include "proc.h"
 
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;  // protects f->ref
+  struct kmem_cache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -31,16 +33,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +66,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -101,68 +97,190 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
+// Read up to n entries of directory f into the array of
+// struct dent at user address addr, starting at f's offset.
+// Returns the number of entries read, 0 at the end.
 int
-fileread(struct file *f, uint64 addr, int n)
+filegetdents(struct file *f, uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct inode *dp = f->ip, *ip;
+  struct dirent de[NGETDENTS];
+  struct dent d;
+  int i, m, k, cnt;
+
+  if(f->type != FD_INODE || f->readable == 0 || dp->type != T_DIR)
+    return -1;
+
+  cnt = 0;
+  while(cnt < n){
+    // take the entries this call will return, and move f's
+    // offset past them, with dp locked, so that another
+    // getdents on f sees the ones after.
+    ilock(dp);
+    m = readi(dp, 0, (uint64)de, f->off, sizeof(de)) / sizeof(de[0]);
+    for(i = k = 0; i < m && k < n - cnt; i++)
+      if(de[i].inum != 0)
+        k++;
+    m = i;
+    f->off += m * sizeof(de[0]);
+    iunlock(dp);
+    if(m <= 0)
+      break;
+
+    // look at the entries without dp locked, since
+    // locking ".." while holding dp could deadlock.
+    for(i = 0; i < m; i++){
+      if(de[i].inum == 0)
+        continue;
+      ip = iget(dp->dev, de[i].inum);
+      ilock(ip);
+      d.ino = ip->inum;
+      d.type = ip->type;
+      d.nlink = ip->nlink;
+      d.size = ip->size;
+      begin_op();  // in case iput() frees an unlinked inode
+      iunlockput(ip);
+      end_op();
+      if(d.type == 0)
+        continue;
+      memmove(d.name, de[i].name, DIRSIZ);
+      d.name[DIRSIZ] = 0;
+      if(copyout(p->pagetable, addr + cnt*sizeof(d), (char*)&d, sizeof(d)) < 0)
+        return -1;
+      cnt++;
+    }
+  }
+  return cnt;
+}
+
+// Read from file f into the n user buffers iov[0..n-1], in
+// order, at offset off, or at f's offset if off is -1.
+// Stops early at the end of the file.
+int
+filereadv(struct file *f, struct iovec *iov, int n, int off)
 {
-  int r = 0;
+  int i, r, tot = 0;
+  uint o;
 
   if(f->readable == 0)
     return -1;
+  if(off >= 0 && f->type != FD_INODE)
+    return -1;
 
-  if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    // these would wait for more to fill a second
+    // buffer, so read into the first non-empty one.
+    for(i = 0; i < n && iov[i].iov_len == 0; i++)
+      ;
+    if(i == n)
+      return 0;
+    if(f->type == FD_PIPE)
+      return piperead(f->pipe, 1, (uint64)iov[i].iov_base, iov[i].iov_len);
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    return devsw[f->major].read(1, (uint64)iov[i].iov_base, iov[i].iov_len);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
+    o = off < 0 ? f->off : off;
+    for(i = 0; i < n; i++){
+      if((r = readi(f->ip, 1, (uint64)iov[i].iov_base, o, iov[i].iov_len)) < 0){
+        // a bad address
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      o += r;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    if(off < 0)
+      f->off = o;
     iunlock(f->ip);
   } else {
     panic("fileread");
   }
 
-  return r;
+  return tot;
 }
 
-// Write to file f.
+// Read from file f.
 // addr is a user virtual address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+fileread(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, -1);
+}
+
+// Write the n user buffers iov[0..n-1] to file f, in order,
+// at offset off, or at f's offset if off is -1.
+int
+filewritev(struct file *f, struct iovec *iov, int n, int off)
+{
+  int i, r = 0, tot = 0, want = 0;
 
   if(f->writable == 0)
     return -1;
+  if(off >= 0 && f->type != FD_INODE)
+    return -1;
+  for(i = 0; i < n; i++)
+    want += iov[i].iov_len;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    if(f->type == FD_DEVICE &&
+       (f->major < 0 || f->major >= NDEV || !devsw[f->major].write))
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    for(i = 0; i < n; i++){
+      if(f->type == FD_PIPE)
+        r = pipewrite(f->pipe, 1, (uint64)iov[i].iov_base, iov[i].iov_len);
+      else
+        r = devsw[f->major].write(1, (uint64)iov[i].iov_base, iov[i].iov_len);
+      if(r < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    return tot;
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
+    // write as many blocks at a time as fit in the
+    // maximum log transaction size, which is set by the
+    // size of the log, less the i-node, two levels of
+    // indirect block, the superblock's free count, and
+    // 2 blocks of slop for non-aligned writes; each block
+    // may need an allocation block too. a write that
+    // fits, however many buffers it gathers from, goes
+    // in one transaction.
+    int max = ((maxopblocks-1-2-1-2) / 2) * BSIZE;
+    int m, n1 = 0, done = 0;
+    uint o;
 
+    i = 0;
+    while(i < n){
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
+      o = off < 0 ? f->off : off + tot;
+      for(m = 0, r = 0; i < n && m < max; m += r){
+        n1 = iov[i].iov_len - done;
+        if(n1 > max - m)
+          n1 = max - m;
+        if((r = writei(f->ip, 1, (uint64)iov[i].iov_base + done, o, n1)) != n1)
+          break;
+        o += r;
+        tot += r;
+        done += r;
+        if(done == iov[i].iov_len){
+          i++;
+          done = 0;
+        }
+      }
+      if(off < 0)
+        f->off = o;
       iunlock(f->ip);
       end_op();
 
@@ -170,13 +288,154 @@ filewrite(struct file *f, uint64 addr, int n)
         // error from writei
         break;
       }
-      i += r;
     }
-    ret = (i == n ? n : -1);
   } else {
     panic("filewrite");
   }
 
-  return ret;
+  return (tot == want ? want : -1);
+}
+
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  struct iovec iov;
+
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, -1);
+}
+
+// Lock two file inodes, the lower-numbered first, so that
+// two sendfile()s between the same files can't deadlock.
+static void
+ilockpair(struct inode *a, struct inode *b)
+{
+  if(a->dev > b->dev || (a->dev == b->dev && a->inum > b->inum)){
+    ilock(b);
+    ilock(a);
+  } else {
+    ilock(a);
+    ilock(b);
+  }
+}
+
+// Move up to n bytes from file in to file out, each at its
+// offset, without copying them through user space. A read
+// from a pipe moves what's there, like read().
+// Returns the number of bytes moved, 0 at the end of in.
+int
+filesend(struct file *out, struct file *in, int n)
+{
+  // as in filewritev().
+  int max = ((maxopblocks-1-2-1-2) / 2) * BSIZE;
+  int m, r = 0, w, tot = 0;
+  char *page;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if((in->type != FD_INODE && in->type != FD_PIPE) ||
+     (out->type != FD_INODE && out->type != FD_PIPE))
+    return -1;
+
+  if(in->type == FD_INODE && out->type == FD_INODE &&
+     in->ip->type == T_FILE && out->ip->type == T_FILE){
+    // file to file: write from the source's buffers.
+    if(in->ip == out->ip)
+      return -1;
+    while(tot < n){
+      m = n - tot;
+      if(m > max)
+        m = max;
+      begin_op();
+      ilockpair(in->ip, out->ip);
+      if((r = copyi(out->ip, out->off, in->ip, in->off, m)) > 0){
+        in->off += r;
+        out->off += r;
+      }
+      iunlock(out->ip);
+      iunlock(in->ip);
+      end_op();
+      if(r < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < m)
+        break;
+    }
+    return tot;
+  }
+
+  // a pipe may wait indefinitely, which mustn't happen with
+  // an inode or a buffer locked, so go through a kernel page.
+  if((page = kalloc()) == 0)
+    return -1;
+  if(max > PGSIZE)
+    max = PGSIZE;
+  while(tot < n){
+    m = n - tot;
+    if(m > max)
+      m = max;
+    if(in->type == FD_PIPE){
+      r = piperead(in->pipe, 0, (uint64)page, m);
+    } else {
+      ilock(in->ip);
+      if((r = readi(in->ip, 0, (uint64)page, in->off, m)) > 0)
+        in->off += r;
+      iunlock(in->ip);
+    }
+    if(r <= 0)
+      break;
+
+    if(out->type == FD_PIPE){
+      w = pipewrite(out->pipe, 0, (uint64)page, r);
+    } else {
+      begin_op();
+      ilock(out->ip);
+      if((w = writei(out->ip, 0, (uint64)page, out->off, r)) > 0)
+        out->off += w;
+      iunlock(out->ip);
+      end_op();
+    }
+    if(w != r){
+      r = -1;
+      break;
+    }
+    tot += w;
+    if(in->type == FD_PIPE)
+      break;
+  }
+  kfree(page);
+  if(r < 0 && tot == 0)
+    return -1;
+  return tot;
 }
 
+// Move f's offset to off bytes from the start (SEEK_SET),
+// the current offset (SEEK_CUR) or the end (SEEK_END).
+// Files can't have holes, so the new offset must be
+// between 0 and the size. Returns it, or -1.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  int o;
+
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  if(whence == SEEK_SET)
+    o = off;
+  else if(whence == SEEK_CUR)
+    o = f->off + off;
+  else if(whence == SEEK_END)
+    o = f->ip->size + off;
+  else
+    o = -1;
+  if(o < 0 || o > f->ip->size)
+    o = -1;
+  else
+    f->off = o;
+  iunlock(f->ip);
+  return o;
+}
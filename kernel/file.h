@@ -18,15 +18,20 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *prev; // itable list, most recently released first
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint goal;          // block bmap tries to allocate next
+  int ndelay;         // blocks in delayed buffers, awaiting allocation
+  uint dsize;         // size on disk while ndelay > 0
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
 
 // map major device number to device functions.
@@ -22,9 +22,32 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
-// there should be one superblock per disk device, but we run with
-// only one device
-struct superblock sb; 
+
+// Per-device file system state, one for each disk.
+struct fs {
+  struct superblock sb;
+  uint bcursor;        // next-fit start for balloc() without a goal
+
+  // Which on-disk inodes are in use, one bit each, so that
+  // ialloc() needn't read inode blocks looking for a free one.
+  // Built from the inode blocks at mount.
+  struct {
+    struct spinlock lock;
+    uchar *used;
+    uint nfree;
+  } imap;
+} fstab[NDISK];
+
+#define FS(dev) (&fstab[(dev)-1])
+
+// File systems mounted on directories of others; see mount().
+struct {
+  struct spinlock lock;
+  struct inode *on[NDISK];  // mountpoint of dev i+1, or 0
+  int ready[NDISK];         // has fsinit(i+1) finished?
+} mtab;
+
+static void imapinit(int);
 
 // Read the super block.
 static void
@@ -37,64 +60,142 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
-// Init fs
-void
+// Init the file system on dev. The root device's also
+// provides swap space and starts the flusher; others are
+// mounted later. Returns -1 if dev has no file system, or
+// its log is smaller than the root's.
+int
 fsinit(int dev) {
-  readsb(dev, &sb);
-  if(sb.magic != FSMAGIC)
-    panic("invalid file system");
-  initlog(dev, &sb);
+  struct fs *fs = FS(dev);
+
+  readsb(dev, &fs->sb);
+  if(fs->sb.magic != FSMAGIC){
+    if(dev == ROOTDEV)
+      panic("invalid file system");
+    return -1;
+  }
+  if(fs->sb.bsize != BSIZE){
+    if(dev == ROOTDEV)
+      panic("file system block size");
+    return -1;
+  }
+  if(initlog(dev, &fs->sb) < 0)
+    return -1;
+  readsb(dev, &fs->sb);  // recovery may have changed the free count
+  fs->bcursor = fs->sb.bmapstart;
+  imapinit(dev);
+  if(dev == ROOTDEV){
+    swapinit(fs->sb.swapstart, fs->sb.nswap);
+    kthread(flusher, "flusher");
+  }
+  return 0;
 }
 
-// Zero a block.
+// Zero a block, which holds file data if data is set.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  if(data)
+    log_write_data(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// The superblock keeps a count of free blocks, updated in the
+// same transaction as the bitmap. Holding the superblock's
+// buffer serializes allocation.
+
+// Record a change of delta in the free block count.
+// Caller holds sbp, the superblock's buffer.
+static void
+bcount(struct buf *sbp, int delta)
+{
+  struct superblock *sb = &FS(sbp->dev)->sb;
+
+  sb->nfree += delta;
+  memmove(sbp->data, sb, sizeof(*sb));
+  log_write(sbp);
+}
+
+// Allocate a zeroed disk block, at goal if it's free, or else
+// the next free one after it. With no goal, carry on from the
+// last block allocated. data says whether it's for file data.
+// Blocks that the current transaction freed aren't reused.
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal, int data)
 {
-  int b, bi, m;
-  struct buf *bp;
-
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+  struct fs *fs = FS(dev);
+  uint b, bi, n, skipped;
+  int m;
+  struct buf *bp, *sbp;
+
+  sbp = bread(dev, 1);
+  if(fs->sb.nfree == 0){
+    brelse(sbp);
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  if(goal == 0 || goal >= fs->sb.size)
+    goal = fs->bcursor;
+
+  b = goal;
+  skipped = 0;
+  for(n = 0; n < fs->sb.size; ){
+    bp = bread(dev, BBLOCK(b, fs->sb));
+    for(bi = b % BPB; bi < BPB && b < fs->sb.size; bi++, b++, n++){
+      if(bi % 8 == 0 && bp->data[bi/8] == 0xff && b + 8 <= fs->sb.size){
+        // whole byte in use.
+        bi += 7;
+        b += 7;
+        n += 7;
+        continue;
+      }
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
+        if(!log_reusable(dev, b)){
+          skipped++;
+          continue;
+        }
         bp->data[bi/8] |= m;  // Mark block in use.
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        fs->bcursor = b + 1;
+        bcount(sbp, -1);
+        brelse(sbp);
+        bzero(dev, b, data);
+        return b;
       }
     }
     brelse(bp);
+    if(b >= fs->sb.size)
+      b = 0;
   }
-  printf("balloc: out of blocks\n");
-  return 0;
+  if(skipped){
+    // the only free blocks are waiting for a commit.
+    brelse(sbp);
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  panic("balloc: free count");
 }
 
 // Free a disk block.
 static void
 bfree(int dev, uint b)
 {
-  struct buf *bp;
+  struct buf *bp, *sbp;
   int bi, m;
 
-  bp = bread(dev, BBLOCK(b, sb));
+  sbp = bread(dev, 1);
+  bp = bread(dev, BBLOCK(b, FS(dev)->sb));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
@@ -102,6 +203,9 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  bcount(sbp, 1);
+  brelse(sbp);
+  log_free(dev, b);
 }
 
 // Inodes.
@@ -119,7 +223,10 @@ bfree(int dev, uint b)
 // to provide a place for synchronizing access
 // to inodes used by multiple processes. The in-memory
 // inodes include book-keeping information that is
-// not stored on disk: ip->ref and ip->valid.
+// not stored on disk: ip->ref and ip->valid. Table
+// entries come from a slab cache, so the table grows
+// as needed; up to NINODE entries that are no longer
+// referenced stay cached, most recently released first.
 //
 // An inode and its in-memory representation go through a
 // sequence of states before they can be used by the
@@ -129,18 +236,17 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to a table entry (open files and
+//   current directories). iget() finds or creates a table
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref is zero may be recycled or freed.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
-//   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ilock() reads the inode from the disk and sets
+//   ip->valid, while iput() clears ip->valid when it
+//   frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -175,47 +281,117 @@ bfree(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+
+  // all table entries, through prev/next. entries are
+  // moved to the front when their ref falls to zero.
+  struct inode head;
+  int nunused;  // entries with ref == 0
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  initlock(&mtab.lock, "mtab");
+  itable.cache = kmem_cache_create("inode", sizeof(struct inode));
+  itable.head.prev = &itable.head;
+  itable.head.next = &itable.head;
+}
+
+static void
+imapinit(int dev)
+{
+  struct fs *fs = FS(dev);
+  struct buf *bp;
+  struct dinode *dip;
+  uint inum;
+  int order;
+
+  initlock(&fs->imap.lock, "imap");
+  for(order = 0; (PGSIZE << order) < fs->sb.ninodes / 8 + 1; order++)
+    ;
+  if((fs->imap.used = kalloc_order(order)) == 0)
+    panic("imapinit");
+  memset(fs->imap.used, 0, PGSIZE << order);
+  fs->imap.used[0] = 1;  // there's no inode 0
+  fs->imap.nfree = 0;
+  for(inum = 1; inum < fs->sb.ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum, fs->sb));
+    dip = (struct dinode*)bp->data + inum%IPB;
+    if(dip->type != 0)
+      fs->imap.used[inum/8] |= 1 << (inum%8);
+    else
+      fs->imap.nfree++;
+    brelse(bp);
   }
 }
 
-static struct inode* iget(uint dev, uint inum);
+// Claim a free inode number, the first at or after near,
+// wrapping around. Returns 0 if there's none.
+static uint
+imapalloc(uint dev, uint near)
+{
+  struct fs *fs = FS(dev);
+  uint inum, n;
+
+  acquire(&fs->imap.lock);
+  if(fs->imap.nfree == 0){
+    release(&fs->imap.lock);
+    return 0;
+  }
+  if(near >= fs->sb.ninodes)
+    near = 1;
+  inum = near;
+  for(n = 0; n < fs->sb.ninodes; n++, inum++){
+    if(inum >= fs->sb.ninodes)
+      inum = 0;
+    if((fs->imap.used[inum/8] & (1 << (inum%8))) == 0){
+      fs->imap.used[inum/8] |= 1 << (inum%8);
+      fs->imap.nfree--;
+      release(&fs->imap.lock);
+      return inum;
+    }
+  }
+  panic("imapalloc: free count");
+}
+
+static void
+imapfree(uint dev, uint inum)
+{
+  struct fs *fs = FS(dev);
 
-// Allocate an inode on device dev.
+  acquire(&fs->imap.lock);
+  fs->imap.used[inum/8] &= ~(1 << (inum%8));
+  fs->imap.nfree++;
+  release(&fs->imap.lock);
+}
+
+// Allocate an inode on device dev, near inode near
+// (the new file's directory) if possible.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
 // or NULL if there is no free inode.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint near)
 {
   int inum;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
-    brelse(bp);
+  if((inum = imapalloc(dev, near)) == 0){
+    printf("ialloc: no inodes\n");
+    return 0;
   }
-  printf("ialloc: no inodes\n");
-  return 0;
+  bp = bread(dev, IBLOCK(inum, FS(dev)->sb));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: inode in use");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
 }
 
 // Copy a modified in-memory inode to disk.
@@ -228,49 +404,80 @@ iupdate(struct inode *ip)
   struct buf *bp;
   struct dinode *dip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  bp = bread(ip->dev, IBLOCK(ip->inum, FS(ip->dev)->sb));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
-  dip->size = ip->size;
+  // the disk mustn't see a size that covers blocks
+  // without addresses yet.
+  dip->size = ip->ndelay > 0 ? ip->dsize : ip->size;
+  if(ip->type == T_FILE && ip->size > NINLINE && dip->size <= NINLINE &&
+     ip->addrs[0] != 0)
+    panic("iupdate: spilled file looks inline");
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
 }
 
+static void
+iunlink(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+static void
+ilinkhead(struct inode *ip)
+{
+  ip->next = itable.head.next;
+  ip->prev = &itable.head;
+  itable.head.next->prev = ip;
+  itable.head.next = ip;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
-static struct inode*
+struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.head.next; ip != &itable.head; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        itable.nunused--;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Not in the table; add an entry, or recycle
+  // the least recently released one if out of memory.
+  if((ip = kmem_cache_alloc(itable.cache)) != 0){
+    initsleeplock(&ip->lock, "inode");
+  } else {
+    for(ip = itable.head.prev; ip != &itable.head; ip = ip->prev)
+      if(ip->ref == 0)
+        break;
+    if(ip == &itable.head)
+      panic("iget: no inodes");
+    iunlink(ip);
+    itable.nunused--;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->goal = 0;
+  ip->ndelay = 0;
+  ilinkhead(ip);
   release(&itable.lock);
 
   return ip;
@@ -301,7 +508,7 @@ ilock(struct inode *ip)
   acquiresleep(&ip->lock);
 
   if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+    bp = bread(ip->dev, IBLOCK(ip->inum, FS(ip->dev)->sb));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
     ip->major = dip->major;
@@ -328,7 +535,8 @@ iunlock(struct inode *ip)
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode table entry can
-// be recycled.
+// be recycled; the oldest unreferenced entries beyond
+// NINODE are freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -347,9 +555,12 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
+    if(ip->type == T_DIR)
+      dcache_purge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
+    imapfree(ip->dev, ip->inum);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
@@ -358,6 +569,17 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0){
+    iunlink(ip);
+    ilinkhead(ip);
+    if(++itable.nunused > NINODE){
+      for(ip = itable.head.prev; ip->ref != 0; ip = ip->prev)
+        ;
+      iunlink(ip);
+      itable.nunused--;
+      kmem_cache_free(itable.cache, ip);
+    }
+  }
   release(&itable.lock);
 }
 
@@ -374,7 +596,45 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The NDINDIRECT blocks
+// after that hang off ip->addrs[NDIRECT+1], a block of
+// NINDIRECT indirect block numbers.
+
+// Return the block number in *slot, allocating a block
+// and recording it in *slot if there's none. data says
+// whether the block is for file data.
+// Returns 0 if out of disk space.
+static uint
+bslot(struct inode *ip, uint *slot, struct buf *bp, int data)
+{
+  uint addr;
+
+  if((addr = *slot) == 0){
+    // keep each file's blocks together.
+    addr = balloc(ip->dev, ip->goal, data);
+    if(addr){
+      ip->goal = addr + 1;
+      *slot = addr;
+      if(bp)
+        log_write(bp);
+    }
+  }
+  return addr;
+}
+
+// Return entry bn of indirect block addr, allocating
+// the block it names if there's none.
+// Returns 0 if out of disk space.
+static uint
+bindirect(struct inode *ip, uint addr, uint bn, int data)
+{
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  addr = bslot(ip, (uint*)bp->data + bn, bp, data);
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -382,42 +642,286 @@ iunlockput(struct inode *ip)
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr;
+  int data = ip->type == T_FILE;  // directories are metadata
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[bn] = addr;
-    }
-    return addr;
-  }
+  if(bn < NDIRECT)
+    return bslot(ip, &ip->addrs[bn], 0, data);
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
+    if((addr = bslot(ip, &ip->addrs[NDIRECT], 0, 0)) == 0)
+      return 0;
+    return bindirect(ip, addr, bn, data);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Two levels: the doubly-indirect block, then an indirect one.
+    if((addr = bslot(ip, &ip->addrs[NDIRECT+1], 0, 0)) == 0)
+      return 0;
+    if((addr = bindirect(ip, addr, bn / NINDIRECT, 0)) == 0)
+      return 0;
+    return bindirect(ip, addr, bn % NINDIRECT, data);
+  }
+
+  panic("bmap: out of range");
+}
+
+// Return entry bn of indirect block addr, or 0 if
+// there's no such indirect block.
+static uint
+bentry(uint dev, uint addr, uint bn)
+{
+  struct buf *bp;
+
+  if(addr == 0)
+    return 0;
+  bp = bread(dev, addr);
+  addr = ((uint*)bp->data)[bn];
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip,
+// or 0 if it has none. Unlike bmap(), never allocates, so
+// readers can use it outside a transaction.
+static uint
+bmapped(struct inode *ip, uint bn)
+{
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+
+  if(bn < NINDIRECT)
+    return bentry(ip->dev, ip->addrs[NDIRECT], bn);
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT)
+    return bentry(ip->dev, bentry(ip->dev, ip->addrs[NDIRECT+1], bn / NINDIRECT),
+                  bn % NINDIRECT);
+
+  panic("bmapped: out of range");
+}
+
+// Free indirect block addr, which has the given number
+// of levels of blocks under it, and all those blocks.
+static void
+bfreeind(int dev, uint addr, int levels)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(levels > 1)
+      bfreeind(dev, a[j], levels - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
+// Is ip's data kept in ip->addrs[]?
+static int
+isinline(struct inode *ip)
+{
+  return ip->type == T_FILE && ip->size <= NINLINE;
+}
+
+// Move the data of inline file ip to a data block,
+// so that it can grow past NINLINE bytes.
+// Returns -1 if out of disk space.
+static int
+ispill(struct inode *ip)
+{
+  char data[NINLINE];
+  struct buf *bp;
+  uint addr;
+
+  memmove(data, ip->addrs, NINLINE);
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  if((addr = bmap(ip, 0)) == 0){
+    memmove(ip->addrs, data, NINLINE);
+    return -1;
+  }
+  bp = bread(ip->dev, addr);
+  memmove(bp->data, data, ip->size);
+  log_write_data(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Undo ispill() for a file that didn't grow after all.
+static void
+iunspill(struct inode *ip)
+{
+  struct buf *bp;
+  uint addr;
+
+  addr = ip->addrs[0];
+  bp = bread(ip->dev, addr);
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  memmove(ip->addrs, bp->data, ip->size);
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
+// Delayed allocation.
+//
+// writei() leaves new blocks of a regular file in delayed
+// buffers (see bio.c) without allocating disk blocks or
+// logging them. iflush() later allocates blocks for all of a
+// file's delayed buffers at once, so they can be placed
+// together, and writes them through the log. The flusher
+// thread does this periodically, and fsync() on demand.
+// An inode with delayed buffers holds a reference to itself,
+// so that it stays in the table.
+
+// Blocks iflush() writes per transaction: each may need a
+// bitmap block too, plus the inode, the superblock and
+// up to three indirect blocks.
+#define NFLUSH ((maxopblocks-1-1-3) / 2)
+
+// Return a locked buffer for writing block bn of ip and set
+// *delayed if it's a delayed buffer. Returns 0 if out of
+// disk space. Caller holds ip->lock.
+static struct buf*
+wbuf(struct inode *ip, uint bn, int *delayed)
+{
+  struct buf *b;
+  uint addr;
+
+  if(ip->type == T_FILE){
+    if(ip->ndelay > 0 && (b = bdelay(ip, bn, 0)) != 0){
+      *delayed = 1;
+      return b;
     }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
+    // a new block past the end of the file, if there's
+    // room for it and for it to be allocated later.
+    if(bn*BSIZE >= ip->size && FS(ip->dev)->sb.nfree > 2*NDELAY &&
+       (b = bdelay(ip, bn, 1)) != 0){
+      memset(b->data, 0, BSIZE);
+      b->valid = 1;
+      if(ip->ndelay++ == 0){
+        idup(ip);
+        // writei() has already written up to block bn through
+        // blocks with addresses. this also keeps a file that
+        // writei() just spilled from looking inline on disk.
+        ip->dsize = bn * BSIZE;
       }
+      *delayed = 1;
+      return b;
     }
-    brelse(bp);
-    return addr;
   }
+  *delayed = 0;
+  if((addr = bmap(ip, bn)) == 0)
+    return 0;
+  return bread(ip->dev, addr);
+}
 
-  panic("bmap: out of range");
+// Delayed buffer b of ip has been written or is being
+// discarded: release it. Caller holds ip->lock and
+// another reference to ip.
+static void
+idelaydone(struct inode *ip, struct buf *b)
+{
+  bundelay(b);
+  brelse(b);
+  if(--ip->ndelay == 0)
+    iput(ip);
+}
+
+// Give ip's delayed blocks disk blocks and write them through
+// the log. Caller holds a reference to ip, but not its lock,
+// and must not be in a transaction. Returns -1 if the disk
+// filled up and some of the file's data was lost.
+int
+iflush(struct inode *ip)
+{
+  struct buf *b, *bp;
+  uint addr;
+  int i, more, r;
+
+  r = 0;
+
+  do {
+    begin_op();
+    ilock(ip);
+    // lowest blocks first, so the size on disk can follow.
+    for(i = 0; i < NFLUSH && (b = bdelayfirst(ip)) != 0; i++){
+      if(ip->nlink == 0 || b->fbn * BSIZE >= ip->size){
+        // nothing to keep.
+      } else if((addr = bmap(ip, b->fbn)) != 0){
+        bp = bread(ip->dev, addr);
+        memmove(bp->data, b->data, BSIZE);
+        log_write_data(bp);
+        brelse(bp);
+        ip->dsize = min(ip->size, (b->fbn + 1) * BSIZE);
+      } else {
+        // the disk filled up anyway: the file ends
+        // before this block, and the rest is lost.
+        ip->size = b->fbn * BSIZE;
+        ip->dsize = ip->size;
+        r = -1;
+      }
+      idelaydone(ip, b);
+    }
+    more = ip->ndelay > 0;
+    iupdate(ip);
+    iunlock(ip);
+    end_op();
+  } while(more);
+  return r;
+}
+
+// Return an inode with delayed blocks, with a new
+// reference to it, or 0 if there's none.
+static struct inode*
+idelayed(void)
+{
+  struct inode *ip;
+
+  acquire(&itable.lock);
+  for(ip = itable.head.next; ip != &itable.head; ip = ip->next){
+    if(ip->ref > 0 && ip->ndelay > 0){
+      ip->ref++;
+      release(&itable.lock);
+      return ip;
+    }
+  }
+  release(&itable.lock);
+  return 0;
+}
+
+// The flusher kernel thread. Flushes all delayed blocks every
+// FLUSHTICKS ticks, or sooner if half of NDELAY are in use.
+void
+flusher(void)
+{
+  struct inode *ip;
+  uint t0;
+
+  for(;;){
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < FLUSHTICKS && bdelaycount() < NDELAY/2)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    while((ip = idelayed()) != 0){
+      iflush(ip);
+      begin_op();
+      iput(ip);
+      end_op();
+    }
+  }
 }
 
 // Truncate inode (discard contents).
@@ -425,9 +929,18 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  struct buf *b;
+  int i;
+
+  while((b = bdelayfirst(ip)) != 0)
+    idelaydone(ip, b);
+
+  if(isinline(ip)){
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -437,17 +950,15 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfreeind(ip->dev, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    bfreeind(ip->dev, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
   ip->size = 0;
   iupdate(ip);
 }
@@ -464,6 +975,24 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// what a block without a disk address reads as.
+static uchar zeroes[BSIZE];
+
+// Return a locked buffer holding block bn of ip, for reading,
+// or 0 if it has no disk address yet. Caller holds ip->lock.
+static struct buf*
+rbuf(struct inode *ip, uint bn)
+{
+  uint addr;
+  struct buf *bp;
+
+  if(ip->ndelay > 0 && (bp = bdelay(ip, bn, 0)) != 0)
+    return bp;
+  if((addr = bmapped(ip, bn)) == 0)
+    return 0;
+  return bread(ip->dev, addr);
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -473,24 +1002,29 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  int r;
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(isinline(ip)){
+    if(either_copyout(user_dst, dst, (char*)ip->addrs + off, n) == -1)
+      return -1;
+    return n;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
+    bp = rbuf(ip, off/BSIZE);
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    r = either_copyout(user_dst, dst, (bp ? bp->data : zeroes) + (off % BSIZE), m);
+    if(bp)
       brelse(bp);
+    if(r == -1) {
       tot = -1;
       break;
     }
-    brelse(bp);
   }
   return tot;
 }
@@ -507,28 +1041,54 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  int spilled = 0, delayed;
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  if(isinline(ip)){
+    if(off + n <= NINLINE){
+      // still fits in the inode.
+      if(either_copyin((char*)ip->addrs + off, user_src, src, n) == -1)
+        return -1;
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+    if(ip->size > 0){
+      if(ispill(ip) < 0)
+        return -1;
+      spilled = 1;
+    }
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
+    if((bp = wbuf(ip, off/BSIZE, &delayed)) == 0)
       break;
-    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
-      brelse(bp);
+      if(delayed && off/BSIZE*BSIZE >= ip->size)
+        idelaydone(ip, bp);  // nothing of it is in the file
+      else
+        brelse(bp);
       break;
     }
-    log_write(bp);
+    if(!delayed){
+      if(ip->type == T_FILE)
+        log_write_data(bp);
+      else
+        log_write(bp);
+    }
     brelse(bp);
   }
 
   if(off > ip->size)
     ip->size = off;
+  if(spilled && ip->size <= NINLINE)
+    iunspill(ip);
 
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
@@ -538,6 +1098,40 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   return tot;
 }
 
+// Copy n bytes at offset soff of src to offset doff of dst,
+// straight from src's buffers. Caller must hold both inodes'
+// locks, inside a transaction. Returns the number of bytes
+// copied, short at the end of src, or -1 if writing failed.
+int
+copyi(struct inode *dst, uint doff, struct inode *src, uint soff, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
+  int r;
+
+  if(soff > src->size || soff + n < soff)
+    return 0;
+  if(soff + n > src->size)
+    n = src->size - soff;
+
+  if(isinline(src))
+    return writei(dst, 0, (uint64)src->addrs + soff, doff, n);
+
+  for(tot=0; tot<n; tot+=m, soff+=m, doff+=m){
+    bp = rbuf(src, soff/BSIZE);
+    m = min(n - tot, BSIZE - soff%BSIZE);
+    r = writei(dst, 0, (uint64)(bp ? bp->data : zeroes) + (soff % BSIZE), doff, m);
+    if(bp)
+      brelse(bp);
+    if(r != m){
+      if(r > 0)
+        tot += r;
+      return tot > 0 ? tot : -1;
+    }
+  }
+  return tot;
+}
+
 // Directories
 
 int
@@ -546,31 +1140,196 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Read or write the n-byte little-endian field at
+// byte k of a directory's header block.
+static uint
+hdrget(struct buf *hp, int k, int n)
+{
+  uint v = 0;
+
+  while(n-- > 0)
+    v = (v << 8) | (uchar)DIRHDR(hp->data, k + n);
+  return v;
+}
+
+static void
+hdrput(struct buf *hp, int k, int n, uint v)
+{
+  int i;
+
+  for(i = 0; i < n; i++, v >>= 8)
+    DIRHDR(hp->data, k + i) = v;
+}
+
+// The bucket block for hash h.
+static uint
+dirbucket(struct buf *hp, uint h)
+{
+  uint depth = hdrget(hp, DIRH_DEPTH, 1);
+
+  return hdrget(hp, DIRH_TABLE + 2*(h & ((1 << depth) - 1)), 2);
+}
+
+// Read block bn of directory dp, allocating it if need be.
+// Returns 0 if out of disk space.
+static struct buf*
+dirblock(struct inode *dp, uint bn)
+{
+  uint addr;
+
+  if((addr = bmap(dp, bn)) == 0)
+    return 0;
+  return bread(dp->dev, addr);
+}
+
+// Look for name in directory dp, which has been set up.
+// Returns the entry's byte offset and sets *pinum,
+// or returns -1 if it isn't there.
+static int
+dirfind(struct inode *dp, char *name, uint *pinum)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint bn, i;
+
+  bp = dirblock(dp, 0);
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+    i = name[1] ? 1 : 0;
+    de = (struct dirent*)bp->data + i;
+    *pinum = de->inum;
+    brelse(bp);
+    return de->inum ? i * sizeof(*de) : -1;
+  }
+  bn = dirbucket(bp, dirhash(name));
+  brelse(bp);
+
+  bp = dirblock(dp, bn);
+  for(i = 1; i < DPB; i++){
+    de = (struct dirent*)bp->data + i;
+    if(de->inum != 0 && namecmp(name, de->name) == 0){
+      *pinum = de->inum;
+      brelse(bp);
+      return bn*BSIZE + i*sizeof(*de);
+    }
+  }
+  brelse(bp);
+  return -1;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint inum, off;
+  int r;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  switch(dcache_lookup(dp->dev, dp->inum, name, &inum, &off)){
+  case 1:
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  case 0:
+    return 0;
+  }
+
+  if(dp->size == 0 || (r = dirfind(dp, name, &inum)) < 0){
+    dcache_enter(dp->dev, dp->inum, name, 0, 0);
+    return 0;
+  }
+  off = r;
+  if(poff)
+    *poff = off;
+  dcache_enter(dp->dev, dp->inum, name, inum, off);
+  return iget(dp->dev, inum);
+}
+
+// Give empty directory dp a header and one bucket.
+static int
+dirinit(struct inode *dp)
+{
+  struct buf *hp, *bp;
+
+  if((hp = dirblock(dp, 0)) == 0)
+    return -1;
+  if((bp = dirblock(dp, 1)) == 0){
+    brelse(hp);
+    return -1;
+  }
+  hdrput(hp, DIRH_DEPTH, 1, 0);
+  hdrput(hp, DIRH_COUNT, 4, 0);
+  hdrput(hp, DIRH_TABLE, 2, 1);
+  log_write(hp);
+  DIRBDEPTH(bp->data) = 0;
+  log_write(bp);
+  brelse(bp);
+  brelse(hp);
+  dp->size = 2*BSIZE;
+  iupdate(dp);
+  return 0;
+}
+
+// Split full bucket bn of directory dp into two, doubling
+// the table first if every table slot for bn is needed.
+// Caller holds hp, the header block.
+// Returns -1 if the table is at its largest or out of disk.
+static int
+dirsplit(struct inode *dp, struct buf *hp, uint bn)
+{
+  struct buf *bp, *np;
+  struct dirent *de, *nde;
+  uint depth, bdepth, nb, j, i, k;
+
+  depth = hdrget(hp, DIRH_DEPTH, 1);
+  bp = dirblock(dp, bn);
+  bdepth = DIRBDEPTH(bp->data);
+  if(bdepth == depth){
+    if((2 << depth) > DIRMAXTABLE){
+      brelse(bp);
+      return -1;
+    }
+    for(j = 0; j < (1 << depth); j++)
+      hdrput(hp, DIRH_TABLE + 2*(j + (1 << depth)), 2,
+             hdrget(hp, DIRH_TABLE + 2*j, 2));
+    depth++;
+    hdrput(hp, DIRH_DEPTH, 1, depth);
+    log_write(hp);
+  }
+
+  nb = dp->size / BSIZE;
+  if((np = dirblock(dp, nb)) == 0){
+    brelse(bp);
+    return -1;
+  }
+  dp->size += BSIZE;
+  iupdate(dp);
+
+  // entries with bit bdepth of their hash set move to nb.
+  k = 1;
+  for(i = 1; i < DPB; i++){
+    de = (struct dirent*)bp->data + i;
+    if(de->inum != 0 && ((dirhash(de->name) >> bdepth) & 1)){
+      nde = (struct dirent*)np->data + k++;
+      *nde = *de;
+      memset(de, 0, sizeof(*de));
     }
   }
+  DIRBDEPTH(bp->data) = bdepth + 1;
+  DIRBDEPTH(np->data) = bdepth + 1;
+  for(j = 0; j < (1 << depth); j++)
+    if(hdrget(hp, DIRH_TABLE + 2*j, 2) == bn && ((j >> bdepth) & 1))
+      hdrput(hp, DIRH_TABLE + 2*j, 2, nb);
+  log_write(bp);
+  log_write(np);
+  log_write(hp);
+  brelse(np);
+  brelse(bp);
 
+  // cached offsets of moved entries are stale.
+  dcache_purge(dp->dev, dp->inum);
   return 0;
 }
 
@@ -579,9 +1338,11 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
-  struct dirent de;
   struct inode *ip;
+  struct buf *hp, *bp;
+  struct dirent *de;
+  uint h, bn, i;
+  int split;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -589,22 +1350,179 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
+  if(dp->size == 0 && dirinit(dp) < 0)
+    return -1;
+  hp = dirblock(dp, 0);
+
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+    i = name[1] ? 1 : 0;
+    de = (struct dirent*)hp->data + i;
+    strncpy(de->name, name, DIRSIZ);
+    de->inum = inum;
+    log_write(hp);
+    brelse(hp);
+    dcache_enter(dp->dev, dp->inum, name, inum, i*sizeof(*de));
+    return 0;
+  }
+
+  // look for a free dirent in the name's bucket; if it's full,
+  // split it once, which almost always makes room.
+  h = dirhash(name);
+  for(split = 0; ; split++){
+    bn = dirbucket(hp, h);
+    bp = dirblock(dp, bn);
+    for(i = 1; i < DPB; i++){
+      de = (struct dirent*)bp->data + i;
+      if(de->inum == 0){
+        memset(de, 0, sizeof(*de));
+        strncpy(de->name, name, DIRSIZ);
+        de->inum = inum;
+        log_write(bp);
+        brelse(bp);
+        hdrput(hp, DIRH_COUNT, 4, hdrget(hp, DIRH_COUNT, 4) + 1);
+        log_write(hp);
+        brelse(hp);
+        dcache_enter(dp->dev, dp->inum, name, inum, bn*BSIZE + i*sizeof(*de));
+        return 0;
+      }
+    }
+    brelse(bp);
+    if(split > 0 || dirsplit(dp, hp, bn) < 0){
+      brelse(hp);
+      return -1;
+    }
+  }
+}
+
+// Remove the entry for name, at byte offset off, from directory dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct buf *hp, *bp;
+
+  bp = dirblock(dp, off / BSIZE);
+  memset(bp->data + off % BSIZE, 0, sizeof(struct dirent));
+  log_write(bp);
+  brelse(bp);
+
+  hp = dirblock(dp, 0);
+  hdrput(hp, DIRH_COUNT, 4, hdrget(hp, DIRH_COUNT, 4) - 1);
+  log_write(hp);
+  brelse(hp);
+
+  dcache_enter(dp->dev, dp->inum, name, 0, 0);
+}
+
+// Is directory dp empty except for "." and ".."?
+int
+dirempty(struct inode *dp)
+{
+  struct buf *hp;
+  uint n;
+
+  if(dp->size == 0)
+    return 1;
+  hp = dirblock(dp, 0);
+  n = hdrget(hp, DIRH_COUNT, 4);
+  brelse(hp);
+  return n == 0;
+}
+
+// Mounts.
+//
+// The file system on device dev can be mounted on an empty
+// directory of another. The mount table holds a reference
+// to that directory, so it stays in the inode table, and
+// namex() crosses between it and the mounted root.
+// There is no unmount.
+
+// Mount dev on directory dp, which the caller has checked is
+// empty, and has a reference to, which the mount table keeps
+// if it succeeds. Must be called inside a transaction.
+int
+mount(uint dev, struct inode *dp)
+{
+  int i;
+
+  if(dev == ROOTDEV || !virtio_disk_present(dev) ||
+     dp->type != T_DIR || dp->inum == ROOTINO)
+    return -1;
+  acquire(&mtab.lock);
+  for(i = 0; i < NDISK; i++){
+    if(mtab.on[i] == dp)
       break;
   }
+  if(i < NDISK || mtab.on[dev-1]){
+    release(&mtab.lock);
+    return -1;
+  }
+  mtab.on[dev-1] = dp;
+  release(&mtab.lock);
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+  if(fsinit(dev) < 0){
+    acquire(&mtab.lock);
+    mtab.on[dev-1] = 0;
+    release(&mtab.lock);
     return -1;
+  }
 
+  acquire(&mtab.lock);
+  mtab.ready[dev-1] = 1;
+  release(&mtab.lock);
   return 0;
 }
 
+// Is dp something mounted on?
+int
+ismountpoint(struct inode *dp)
+{
+  int i, r;
+
+  r = 0;
+  acquire(&mtab.lock);
+  for(i = 0; i < NDISK; i++)
+    if(mtab.on[i] == dp)
+      r = 1;
+  release(&mtab.lock);
+  return r;
+}
+
+// If ip is a mountpoint, swap it for the mounted root.
+static struct inode*
+mountroot(struct inode *ip)
+{
+  int i;
+
+  acquire(&mtab.lock);
+  for(i = 0; i < NDISK; i++){
+    if(mtab.on[i] == ip && mtab.ready[i]){
+      release(&mtab.lock);
+      iput(ip);
+      return iget(i+1, ROOTINO);
+    }
+  }
+  release(&mtab.lock);
+  return ip;
+}
+
+// If ip is a mounted root, swap it for its mountpoint,
+// whose ".." is the mounted root's.
+static struct inode*
+mountpoint(struct inode *ip)
+{
+  struct inode *dp;
+
+  if(ip->dev == ROOTDEV || ip->inum != ROOTINO)
+    return ip;
+  acquire(&mtab.lock);
+  dp = mtab.on[ip->dev-1];
+  release(&mtab.lock);
+  if(dp == 0)
+    return ip;
+  iput(ip);
+  return idup(dp);
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -659,6 +1577,8 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    if(namecmp(name, "..") == 0)
+      ip = mountpoint(ip);
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -674,7 +1594,7 @@ namex(char *path, int nameiparent, char *name)
       return 0;
     }
     iunlockput(ip);
-    ip = next;
+    ip = mountroot(next);
   }
   if(nameiparent){
     iput(ip);
@@ -3,14 +3,16 @@
 
 
 #define ROOTINO  1   // root i-number
-#define BSIZE 1024  // block size
+#ifndef BSIZE
+#define BSIZE 1024  // block size; make BSIZE=4096 for 4 KiB blocks
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                                  free bit map | data blocks | swap ]
 //
-// mkfs computes the super block and builds an initial file system. The
-// super block describes the disk layout:
+// mkfs computes the super block and builds an initial file system of
+// the size asked for. The super block describes the disk layout:
 struct superblock {
   uint magic;        // Must be FSMAGIC
   uint size;         // Size of file system image (blocks)
@@ -20,13 +22,36 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint swapstart;    // Block number of first swap block
+  uint nswap;        // Number of pages of swap space
+  uint bsize;        // Block size (bytes); must be BSIZE
+  uint nfree;        // Number of free blocks
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+// The log starts with a journal superblock; the rest is a
+// circular area of records. A record is its descriptor, in
+// as many blocks as it takes, then the logged blocks. The
+// descriptor is a header (JMAGIC, sequence number, # of
+// blocks, # of revoked blocks), the logged blocks' home
+// block numbers, and the revoked block numbers.
+struct jsuper {
+  uint magic;        // Must be JMAGIC
+  uint tail;         // where the oldest record not installed starts
+  uint seq;          // its sequence number
+};
+
+#define JMAGIC 0x4a524e4c
+#define DESCHDR 4
+#define DESCBLOCKS(n, nr) ((DESCHDR + (n) + (nr) + BSIZE/sizeof(uint) - 1) / (BSIZE/sizeof(uint)))
+// descriptor blocks of the biggest record (needs param.h)
+#define MAXDESC DESCBLOCKS(LOGSIZE, LOGSIZE+NCKPT)
+
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,9 +60,13 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
+// A regular file of at most NINLINE bytes keeps its data
+// in addrs[] instead of in data blocks.
+#define NINLINE       ((NDIRECT+2) * sizeof(uint))
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -58,3 +87,45 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Directories are indexed by a hash of the entry names
+// (extendible hashing), but every block is still an array
+// of dirents, and unused dirents have inum 0.
+//
+// Block 0 holds "." and ".." in its first two dirents. The
+// name bytes of its other dirents hold a header: the table
+// depth, the number of entries (other than . and ..), and a
+// table of 2^depth bucket block numbers, indexed by the low
+// depth bits of a name's hash.
+//
+// Every other block is a bucket. Its first dirent is empty
+// except for the bucket's own depth in name[0]; the rest hold
+// the entries whose hashes lead to it.
+
+// Dirents per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// Byte k of the header in directory block 0.
+#define DIRHDR(blk, k) (((struct dirent*)(blk))[2 + (k)/DIRSIZ].name[(k)%DIRSIZ])
+#define DIRHDRSIZE     ((DPB - 2) * DIRSIZ)
+#define DIRH_DEPTH     0  // 1 byte
+#define DIRH_COUNT     1  // 4 bytes
+#define DIRH_TABLE     5  // 2 bytes per bucket number
+#define DIRMAXTABLE    ((DIRHDRSIZE - DIRH_TABLE) / 2)
+
+// Depth of a bucket block.
+#define DIRBDEPTH(blk) (((struct dirent*)(blk))[0].name[0])
+
+// Hash of a directory entry name (FNV-1a).
+static inline uint
+dirhash(const char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
@@ -0,0 +1,182 @@
+// Disk request queue.
+//
+// Every disk read or write waits here for its turn. Each disk
+// has its own queue, and at most IOQDEPTH requests are at a
+// disk at once, so that the device can work on several while
+// enough stay queued for the policy to order. When one
+// finishes, the policy picks which waiting request goes next:
+//
+//   FIFO      the one that arrived first.
+//   ELEVATOR  the one with the nearest block number at or after
+//             the last one started, wrapping round to the lowest,
+//             so the disk is swept in one direction.
+//   DEADLINE  like ELEVATOR, unless the oldest request has waited
+//             too long, in which case that one; reads have a
+//             shorter deadline than writes.
+//
+// The policy and the statistics cover all the disks.
+//
+// Callers bracket the driver call with iostart() and iodone().
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "iosched.h"
+#include "defs.h"
+#include "virtio.h"
+
+// a quarter of the ring: a single-block request takes three
+// descriptors, which leaves room for a bwritev() batch.
+#define IOQDEPTH (NUM/4)
+
+// the time CSR counts at 10 MHz in qemu.
+#define USEC(t)   ((t) / 10)
+#define REXPIRE   (500 * 1000 * 10)   // reads are overdue after 500ms,
+#define WEXPIRE   (5000 * 1000 * 10)  // writes after 5s
+
+// one disk's queue.
+struct ioqueue {
+  struct ioreq *head;  // waiting requests, oldest first
+  int inflight;        // requests at the disk
+  uint pos;            // block number of the last one started
+};
+
+struct {
+  struct spinlock lock;
+  struct ioqueue q[NDISK];  // indexed by dev-1
+  int policy;
+  struct iostat st;
+} ioq;
+
+void
+ioschedinit(void)
+{
+  initlock(&ioq.lock, "ioq");
+  ioq.policy = IOS_DEADLINE;
+  ioq.st.policy = ioq.policy;
+}
+
+// the waiting request with the nearest block number
+// at or after q->pos, or else the lowest.
+static struct ioreq*
+elevator(struct ioqueue *q)
+{
+  struct ioreq *r, *up, *low;
+
+  up = low = 0;
+  for(r = q->head; r; r = r->next){
+    if(r->blockno >= q->pos && (up == 0 || r->blockno < up->blockno))
+      up = r;
+    if(low == 0 || r->blockno < low->blockno)
+      low = r;
+  }
+  return up ? up : low;
+}
+
+static struct ioreq*
+pick(struct ioqueue *q)
+{
+  if(q->head == 0)
+    return 0;
+  switch(ioq.policy){
+  case IOS_FIFO:
+    return q->head;
+  case IOS_DEADLINE:
+    if(r_time() >= q->head->deadline)
+      return q->head;
+    return elevator(q);
+  default:
+    return elevator(q);
+  }
+}
+
+// Start the next request for q's disk, if there's room
+// at the disk. Caller holds ioq.lock.
+static void
+dispatch(struct ioqueue *q)
+{
+  struct ioreq *r, **pp;
+
+  if(q->inflight >= IOQDEPTH || (r = pick(q)) == 0)
+    return;
+  for(pp = &q->head; *pp != r; pp = &(*pp)->next)
+    ;
+  *pp = r->next;
+  r->go = 1;
+  q->inflight++;
+  q->pos = r->blockno;
+  wakeup(r);
+}
+
+// Queue a request for blockno on device dev, and
+// return when it's r's turn to go to the disk.
+void
+iostart(struct ioreq *r, uint dev, uint blockno, int write)
+{
+  struct ioqueue *q = &ioq.q[dev-1];
+  struct ioreq **pp;
+
+  acquire(&ioq.lock);
+  r->dev = dev;
+  r->blockno = blockno;
+  r->write = write != 0;
+  r->t0 = r_time();
+  r->deadline = r->t0 + (write ? WEXPIRE : REXPIRE);
+  r->go = 0;
+  r->next = 0;
+  for(pp = &q->head; *pp; pp = &(*pp)->next)
+    ;
+  *pp = r;
+  dispatch(q);
+  while(!r->go)
+    sleep(r, &ioq.lock);
+  r->t1 = r_time();
+  release(&ioq.lock);
+}
+
+// The disk has finished r: account for it and start the next.
+void
+iodone(struct ioreq *r)
+{
+  struct ioqueue *q = &ioq.q[r->dev-1];
+  uint64 lat;
+  int w = r->write;
+
+  acquire(&ioq.lock);
+  lat = USEC(r_time() - r->t0);
+  ioq.st.n[w]++;
+  ioq.st.wait[w] += USEC(r->t1 - r->t0);
+  ioq.st.lat[w] += lat;
+  if(lat > ioq.st.max[w])
+    ioq.st.max[w] = lat;
+  q->inflight--;
+  dispatch(q);
+  release(&ioq.lock);
+}
+
+// Switch to policy, if it's valid, and clear the statistics.
+// Returns the old policy, or -1.
+int
+iosched(int policy)
+{
+  int old;
+
+  if(policy < 0 || policy >= NIOSCHED)
+    return -1;
+  acquire(&ioq.lock);
+  old = ioq.policy;
+  ioq.policy = policy;
+  memset(&ioq.st, 0, sizeof(ioq.st));
+  ioq.st.policy = policy;
+  release(&ioq.lock);
+  return old;
+}
+
+void
+iostat(struct iostat *st)
+{
+  acquire(&ioq.lock);
+  *st = ioq.st;
+  release(&ioq.lock);
+}
@@ -0,0 +1,33 @@
+// Disk request scheduling policies, for iosched().
+#define IOS_FIFO     0  // in order of arrival
+#define IOS_ELEVATOR 1  // in block order, sweeping up the disk
+#define IOS_DEADLINE 2  // elevator, but overdue requests first
+#define NIOSCHED     3
+
+// Disk request counts and latencies, for iostat().
+// Index 0 is for reads, 1 for writes. Times are in
+// microseconds, from when a request is queued.
+struct iostat {
+  int policy;
+  uint n[2];       // requests finished
+  uint64 wait[2];  // total time waiting to start
+  uint64 lat[2];   // total time until finished
+  uint64 max[2];   // longest time until finished
+};
+
+// How the disk driver waits for requests, for diskpoll().
+#define DISKPOLL_OFF   0  // sleep until the disk interrupts
+#define DISKPOLL_READS 1  // spin a while for single-block reads
+#define DISKPOLL_ALL   2  // spin a while for single-block reads and writes
+
+// A request waiting for, or at, the disk.
+struct ioreq {
+  uint dev;
+  uint blockno;
+  int write;
+  int go;           // has it been started?
+  uint64 t0;        // time queued
+  uint64 t1;        // time started
+  uint64 deadline;
+  struct ioreq *next;
+};
@@ -1,6 +1,7 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates blocks of 2^order
+// physically contiguous 4096-byte pages.
 
 #include "types.h"
 #include "param.h"
@@ -16,17 +17,48 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+// Free memory is kept by a buddy system. A free block of 2^k
+// pages sits on list free[k], and the entry in order[] for its
+// first page is FREEBLK|k. The block's buddy is the one whose
+// page number differs only in bit k; freeing a block merges it
+// with its buddy for as long as the buddy is free as well.
+#define NPAGE ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PG2PA(pg) ((struct run*)(KERNBASE + (uint64)(pg) * PGSIZE))
+#define FREEBLK 0x80
+
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run free[MAXORDER+1]; // list heads
+  int nfree[MAXORDER+1];       // blocks on each list
+  int npage;                   // free pages in all
+  uchar order[NPAGE];
 } kmem;
 
+// Pages zeroed ahead of time by the kzero kernel thread,
+// which the scheduler wakes when a CPU has nothing to run,
+// so that kalloc_zeroed() needn't zero in the caller's path.
+#define ZPOOLMAX   256 // most pages to keep zeroed
+#define ZPOOLBATCH 16  // pages to zero per idle wakeup
+
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} zpool;
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  initlock(&zpool.lock, "zpool");
+  for(int k = 0; k <= MAXORDER; k++){
+    kmem.free[k].next = &kmem.free[k];
+    kmem.free[k].prev = &kmem.free[k];
+  }
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -39,29 +71,137 @@ freerange(void *pa_start, void *pa_end)
     kfree(p);
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+static void
+pushfree(uint64 pg, int k)
+{
+  struct run *r = PG2PA(pg);
+
+  kmem.order[pg] = FREEBLK | k;
+  r->next = kmem.free[k].next;
+  r->prev = &kmem.free[k];
+  kmem.free[k].next->prev = r;
+  kmem.free[k].next = r;
+  kmem.nfree[k]++;
+  kmem.npage += 1 << k;
+}
+
+static void
+removefree(uint64 pg, int k)
+{
+  struct run *r = PG2PA(pg);
+
+  kmem.order[pg] = 0;
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  kmem.nfree[k]--;
+  kmem.npage -= 1 << k;
+}
+
+// Take a block of 2^order pages off the free lists,
+// splitting a larger block if need be.
+static struct run *
+buddyalloc(int order)
+{
+  uint64 pg;
+  int k;
+
+  acquire(&kmem.lock);
+  for(k = order; k <= MAXORDER && kmem.nfree[k] == 0; k++)
+    ;
+  if(k > MAXORDER){
+    release(&kmem.lock);
+    return 0;
+  }
+  pg = PA2PG(kmem.free[k].next);
+  removefree(pg, k);
+  // give back the upper halves.
+  while(k > order){
+    k--;
+    pushfree(pg + (1L << k), k);
+  }
+  release(&kmem.lock);
+  return PG2PA(pg);
+}
+
+// Free the block of 2^order pages of physical memory at pa,
+// which normally should have been returned by a call to
+// kalloc_order(order).  (The exception is when initializing
+// the allocator; see kinit above.)
 void
-kfree(void *pa)
+kfree_order(void *pa, int order)
 {
-  struct run *r;
+  uint64 pg, buddy;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+  if(order < 0 || order > MAXORDER || ((uint64)pa % (PGSIZE << order)) != 0 ||
+     (char*)pa < end || (uint64)pa + (PGSIZE << order) > PHYSTOP)
     panic("kfree");
 
+#ifndef NOJUNK
   // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  memset(pa, 1, PGSIZE << order);
+#endif
 
-  r = (struct run*)pa;
+  pg = PA2PG(pa);
 
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  if(kmem.order[pg] & FREEBLK)
+    panic("kfree: free block");
+  for(; order < MAXORDER; order++){
+    buddy = pg ^ (1L << order);
+    if(buddy >= NPAGE || kmem.order[buddy] != (FREEBLK | order))
+      break;
+    removefree(buddy, order);
+    pg &= ~(1L << order);
+  }
+  pushfree(pg, order);
   release(&kmem.lock);
 }
 
+// Free the page of physical memory pointed at by pa,
+// which normally should have been returned by a
+// call to kalloc().
+void
+kfree(void *pa)
+{
+  kfree_order(pa, 0);
+}
+
+// Take a page from the zeroed pool, or return 0 if it's empty.
+// The page is zero apart from its first word.
+static struct run *
+zpoolget(void)
+{
+  struct run *r;
+
+  acquire(&zpool.lock);
+  r = zpool.list;
+  if(r){
+    zpool.list = r->next;
+    zpool.n--;
+  }
+  release(&zpool.lock);
+  return r;
+}
+
+// Allocate 2^order physically contiguous pages,
+// aligned to their size.
+// Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_order(int order)
+{
+  struct run *r;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  r = buddyalloc(order);
+#ifndef NOJUNK
+  if(r)
+    memset((char*)r, 5, PGSIZE << order); // fill with junk
+#endif
+  return (void*)r;
+}
+
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
@@ -70,13 +210,85 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  if((r = buddyalloc(0)) == 0)
+    r = zpoolget();
 
+#ifndef NOJUNK
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   return (void*)r;
 }
+
+// Allocate one zeroed 4096-byte page of physical memory,
+// preferably one zeroed ahead of time.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  if((r = zpoolget()) != 0){
+    r->next = 0;
+    return (void*)r;
+  }
+  if((r = buddyalloc(0)) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Number of pages kalloc() could hand out now.
+int
+kfreepages(void)
+{
+  return kmem.npage + zpool.n;
+}
+
+// Copy the number of free blocks of each order
+// into nfree[0..MAXORDER].
+void
+kmemstat(int *nfree)
+{
+  acquire(&kmem.lock);
+  for(int k = 0; k <= MAXORDER; k++)
+    nfree[k] = kmem.nfree[k];
+  release(&kmem.lock);
+}
+
+// Called by the scheduler when it found nothing to run.
+// Wake kzero if the pool needs filling.
+void
+kalloc_idle(void)
+{
+  // racy reads; a stale answer only delays or repeats a wakeup.
+  if(zpool.n < ZPOOLMAX && kmem.npage > 0)
+    wakeup(&zpool);
+}
+
+// The kzero kernel thread. Each time kalloc_idle() wakes it,
+// moves up to ZPOOLBATCH free pages to the zeroed pool,
+// then goes back to sleep.
+void
+kzero(void)
+{
+  struct run *r;
+  int i;
+
+  acquire(&zpool.lock);
+  for(;;){
+    sleep(&zpool, &zpool.lock);
+    for(i = 0; i < ZPOOLBATCH && zpool.n < ZPOOLMAX; i++){
+      release(&zpool.lock);
+
+      if((r = buddyalloc(0)) != 0)
+        memset((char*)r, 0, PGSIZE);
+
+      acquire(&zpool.lock);
+      if(r == 0)
+        break;
+      r->next = zpool.list;
+      zpool.list = r;
+      zpool.n++;
+    }
+  }
+}
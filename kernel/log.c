@@ -7,6 +7,8 @@
 #include "fs.h"
 #include "buf.h"
 
+#define NFREED 512  // freed blocks a transaction tracks per device
+
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
@@ -21,105 +23,351 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
-// The log is a physical re-do log containing disk blocks.
+// The log is a physical re-do journal containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
-// Log appends are synchronous.
-
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+//   journal superblock: where replay starts (struct jsuper)
+//   a circular area of records, one per transaction:
+//     descriptor block(s): sequence number, block #s for
+//       block A, B, C, ..., and revoked block #s
+//     block A
+//     block B
+//     block C
+//     ...
+// Log appends are synchronous. A record's first descriptor block
+// is written last, and writing it commits the transaction.
+//
+// Committed blocks aren't copied home at once: they stay pinned
+// in the cache, and later transactions that change them again
+// just log them again. Only when the journal or the cache is
+// close to full does a checkpoint write them all home and empty
+// the journal, so a block that every transaction changes, like
+// the bitmap or the root directory, is installed once per
+// checkpoint rather than once per transaction. Recovery replays
+// every record after the last checkpoint, in order.
+//
+// A block that's freed while the journal holds a copy of it is
+// revoked in the freeing transaction's record, so that recovery
+// won't replay the stale copy over whatever the block is used
+// for next.
+//
+// Each disk with a file system has its own log, but there is
+// one transaction for all of them: begin_op() and end_op() count
+// FS system calls on every device, and commit() commits each
+// device's log in turn. An FS system call only changes one
+// device, so each one's updates still commit atomically.
+//
+// The size of the log is up to mkfs. The root device's log,
+// less room for a record's descriptors and up to LOGSIZE
+// blocks of it, sets how much one transaction may log in all,
+// and so maxopblocks, the blocks one FS system call may write.
+// Other devices' logs must be as big.
+//
+// File data isn't logged (unless the kernel is built with
+// LOGDATA): log_write_data() just pins the block, and commit()
+// writes it in place before it writes the log, so metadata
+// never points at data that isn't on disk yet. That halves
+// the writes for bulk data. Writing in place is only safe if
+// the block wasn't metadata in the last committed state, so
+// blocks freed by a transaction aren't reused until it commits.
+
+#define EPB     (BSIZE / sizeof(uint))  // descriptor entries per block
+#define NREVOKE (LOGSIZE + NCKPT)       // most blocks a record revokes
+
+// The current transaction's blocks, to log at commit.
 struct logheader {
   int n;
   int block[LOGSIZE];
 };
 
+// one device's log.
+struct devlog {
+  int start;       // the journal superblock
+  int size;        // blocks in the circular area after it
+  int dev;
+  int live;        // recovered, and part of transactions?
+  int head;        // where the next record goes
+  int used;        // blocks of records since the last checkpoint
+  uint seq;        // sequence number of the next record
+  struct logheader lh;
+  int nrevoke;     // blocks to revoke in the next record
+  uint revoke[NREVOKE];
+  int ncp;         // committed blocks not yet installed, pinned
+  int cp[NCKPT+LOGSIZE];
+  int nord;        // data blocks to write in place
+  int ord[LOGSIZE];
+  int nfreed;      // blocks freed by this transaction
+  uint freed[NFREED];
+  int freefull;    // freed[] overflowed; log all data
+};
+
 struct log {
   struct spinlock lock;
-  int start;
-  int size;
+  int size;        // most blocks a transaction logs, on all devices
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
-  int dev;
-  struct logheader lh;
+  uint ncommit;    // transactions committed so far
+  uint nlogged;    // blocks written to the log so far
+  uint nordered;   // data blocks written in place so far
+  uint ncheckpoint; // checkpoints so far
+  uint ninstalled; // blocks they wrote home
+  struct devlog dl[NDISK];  // indexed by dev-1
+
+  // for commit(), which runs alone; too big for the stack.
+  struct buf *b[NCKPT+LOGSIZE+MAXDESC];
+  uint blockno[NCKPT+LOGSIZE+MAXDESC];
 };
 struct log log;
 
-static void recover_from_log(void);
+// a revoked block, in recovery.
+struct revoke {
+  uint block;
+  uint seq;        // of the record that revoked it
+};
+
+int maxopblocks;   // most blocks one FS system call may write
+
+static void recover_from_log(struct devlog *l);
 static void commit();
 
-void
+// Called by fsinit() for each device, ROOTDEV first.
+// Other devices are mounted while FS system calls may be
+// running, so commit() ignores a log until it's recovered.
+// Returns -1 if dev's log is too small.
+int
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
+  struct devlog *l = &log.dl[dev-1];
+  int n;
+
+  if (sizeof(struct jsuper) >= BSIZE)
+    panic("initlog: too big jsuper");
+  // with NCKPT blocks waiting to be installed, a transaction's
+  // blocks and the delayed ones all pinned, the cache has just
+  // NBUFWORK left, and commit needs MAXDESC of them.
+  if (MAXDESC + 8 > NBUFWORK)
+    panic("initlog: NBUFWORK too small");
+
+  // every record must fit, with its descriptors.
+  n = sb->nlog - 1 - MAXDESC;
+  if (n > LOGSIZE)
+    n = LOGSIZE;
+  if (dev == ROOTDEV) {
+    initlock(&log.lock, "log");
+    if (n < 3*MAXOPBLOCKS)
+      panic("initlog: log too small");
+    log.size = n;
+    // leave room for three FS system calls at once.
+    maxopblocks = n / 3;
+  } else if (n < log.size) {
+    return -1;
+  }
+  l->start = sb->logstart;
+  l->size = sb->nlog - 1;
+  l->dev = dev;
+  recover_from_log(l);
+  acquire(&log.lock);
+  l->live = 1;
+  release(&log.lock);
+  return 0;
+}
 
-  initlock(&log.lock, "log");
-  log.start = sb->logstart;
-  log.size = sb->nlog;
-  log.dev = dev;
-  recover_from_log();
+// the disk block at position pos of l's circular area.
+static uint
+logblock(struct devlog *l, int pos)
+{
+  return l->start + 1 + pos % l->size;
 }
 
-// Copy committed blocks from log to their home location
+// Write the pinned cache blocks block[0..n-1] of dev
+// to their home locations and unpin them. They go in block
+// order, so that the disk can merge neighbours.
 static void
-install_trans(int recovering)
+write_home(int dev, int *block, int n)
 {
-  int tail;
+  struct buf **b = log.b;
+  uint *blockno = log.blockno;
+  int tail, i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  if (n == 0)
+    return;
+  for (tail = 0; tail < n; tail++) {
+    for (i = tail; i > 0 && blockno[i-1] > block[tail]; i--) {
+      blockno[i] = blockno[i-1];
+      b[i] = b[i-1];
+    }
+    blockno[i] = block[tail];
+    b[i] = bread(dev, block[tail]);
+  }
+  bwritev(b, blockno, n);
+  for (tail = 0; tail < n; tail++) {
+    bunpin(b[tail]);
+    brelse(b[tail]);
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Write the journal superblock: replay starts at
+// the head, with the next sequence number.
 static void
-read_head(void)
+write_super(struct devlog *l)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
-  }
-  brelse(buf);
+  struct buf *bp = bblank(l->dev, l->start);
+  struct jsuper *js = (struct jsuper *) (bp->data);
+
+  memset(bp->data, 0, BSIZE);
+  js->magic = JMAGIC;
+  js->tail = l->head;
+  js->seq = l->seq;
+  bwrite(bp);
+  brelse(bp);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Install every committed block and empty the journal.
+// Only called between transactions, so the cache holds
+// just what's committed.
 static void
-write_head(void)
+checkpoint(struct devlog *l)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  log.ncheckpoint++;
+  log.ninstalled += l->ncp;
+  write_home(l->dev, l->cp, l->ncp);
+  l->ncp = 0;
+  l->used = 0;
+  write_super(l);
+}
+
+// Entry e of the descriptor of the record at pos.
+static uint
+descent(struct devlog *l, int pos, int e)
+{
+  struct buf *bp = bread(l->dev, logblock(l, pos + e / EPB));
+  uint v = ((uint *) bp->data)[e % EPB];
+
+  brelse(bp);
+  return v;
+}
+
+// If there's a record with sequence number seq at pos, set
+// *n and *nr to its numbers of blocks and revoked blocks and
+// return its number of descriptor blocks. Otherwise return 0.
+static int
+record(struct devlog *l, int pos, uint seq, int *n, int *nr)
+{
+  struct buf *bp = bread(l->dev, logblock(l, pos));
+  uint *d = (uint *) bp->data;
+  int nd = 0;
+
+  if (d[0] == JMAGIC && d[1] == seq && d[2] <= LOGSIZE && d[3] <= NREVOKE) {
+    *n = d[2];
+    *nr = d[3];
+    nd = DESCBLOCKS(*n, *nr);
   }
-  bwrite(buf);
-  brelse(buf);
+  brelse(bp);
+  return nd;
+}
+
+// Is block b revoked by a record at or after seq?
+static int
+revoked(struct revoke *rv, int nrv, uint b, uint seq)
+{
+  int i;
+
+  for (i = 0; i < nrv; i++)
+    if (rv[i].block == b && rv[i].seq >= seq)
+      return 1;
+  return 0;
 }
 
+// Replay the records committed since the last checkpoint
+// and empty the journal.
 static void
-recover_from_log(void)
+recover_from_log(struct devlog *l)
+{
+  struct buf *bp, *lbuf, *dbuf;
+  struct jsuper *js;
+  struct revoke *rv;
+  int pos, used, n, nr, nd, i, nrv, order;
+  uint seq, b;
+
+  bp = bread(l->dev, l->start);
+  js = (struct jsuper *) (bp->data);
+  if (js->magic == JMAGIC && js->tail < l->size) {
+    l->head = js->tail;
+    l->seq = js->seq;
+  } else {
+    // a new file system.
+    l->head = 0;
+    l->seq = 1;
+  }
+  brelse(bp);
+
+  // the committed records follow the tail in sequence;
+  // count their revokes.
+  pos = l->head;
+  used = 0;
+  nrv = 0;
+  for (seq = l->seq; (nd = record(l, pos, seq, &n, &nr)) > 0; seq++) {
+    if (used + nd + n > l->size)
+      break;
+    nrv += nr;
+    pos += nd + n;
+    used += nd + n;
+  }
+
+  rv = 0;
+  order = 0;
+  if (nrv > 0) {
+    while ((PGSIZE << order) < nrv * sizeof(struct revoke))
+      order++;
+    if ((rv = kalloc_order(order)) == 0)
+      panic("recover_from_log: revokes");
+    nrv = 0;
+    for (pos = l->head, seq = l->seq; pos < l->head + used; pos += nd + n, seq++) {
+      nd = record(l, pos, seq, &n, &nr);
+      for (i = 0; i < nr; i++) {
+        rv[nrv].block = descent(l, pos, DESCHDR + n + i);
+        rv[nrv++].seq = seq;
+      }
+    }
+  }
+
+  // copy each logged block home, in order, unless revoked.
+  for (pos = l->head, seq = l->seq; pos < l->head + used; pos += nd + n, seq++) {
+    nd = record(l, pos, seq, &n, &nr);
+    for (i = 0; i < n; i++) {
+      b = descent(l, pos, DESCHDR + i);
+      if (revoked(rv, nrv, b, seq))
+        continue;
+      lbuf = bread(l->dev, logblock(l, pos + nd + i)); // read log block
+      dbuf = bread(l->dev, b); // read dst
+      memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      bwrite(dbuf);  // write dst to disk
+      brelse(lbuf);
+      brelse(dbuf);
+    }
+  }
+  if (rv)
+    kfree_order(rv, order);
+
+  l->head = pos % l->size;
+  l->seq = seq;
+  l->used = 0;
+  write_super(l); // clear the log
+}
+
+// blocks logged by the current transaction, on all devices,
+// and data blocks it will write in place,
+// which with every FS system call's maxopblocks must fit in
+// log.size, and in the buffer cache. caller holds log.lock.
+static int
+logged(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct devlog *l;
+  int n = 0;
+
+  for (l = log.dl; l < log.dl+NDISK; l++)
+    if (l->live)
+      n += l->lh.n + l->nord;
+  return n;
 }
 
 // called at the start of each FS system call.
@@ -130,7 +378,7 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(logged() + (log.outstanding+1)*maxopblocks > log.size){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
@@ -169,42 +417,155 @@ end_op(void)
     commit();
     acquire(&log.lock);
     log.committing = 0;
+    log.ncommit++;
     wakeup(&log);
     release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Wait until the updates of FS system calls that have
+// already called end_op() are committed to disk.
+void
+log_sync(void)
+{
+  uint n;
+
+  acquire(&log.lock);
+  n = log.ncommit;
+  while((logged() > 0 || log.committing) && log.ncommit == n)
+    sleep(&log, &log.lock);
+  release(&log.lock);
+}
+
+// Copy the number of transactions committed, the blocks
+// they logged, the most a transaction may log, maxopblocks,
+// the data blocks written in place, the checkpoints and the
+// blocks they installed to st[0..6].
+void
+log_stat(uint *st)
+{
+  acquire(&log.lock);
+  st[0] = log.ncommit;
+  st[1] = log.nlogged;
+  st[2] = log.size;
+  st[3] = maxopblocks;
+  st[4] = log.nordered;
+  st[5] = log.ncheckpoint;
+  st[6] = log.ninstalled;
+  release(&log.lock);
+}
+
+// Append the current transaction's record at the head of the
+// journal: the logged blocks straight from the cache, and all
+// but the first descriptor block, as one batch; then the first
+// descriptor block -- the real commit.
+static void
+write_record(struct devlog *l)
+{
+  struct buf **b = log.b;
+  uint *to = log.blockno;
+  uint *d;
+  int nd, n, i, e;
+
+  nd = DESCBLOCKS(l->lh.n, l->nrevoke);
+  for (i = 0; i < nd; i++) {
+    b[i] = bblank(l->dev, logblock(l, l->head + i));
+    memset(b[i]->data, 0, BSIZE);
+    to[i] = logblock(l, l->head + i);
+  }
+  d = (uint *) b[0]->data;
+  d[0] = JMAGIC;
+  d[1] = l->seq;
+  d[2] = l->lh.n;
+  d[3] = l->nrevoke;
+  e = DESCHDR;
+  for (i = 0; i < l->lh.n; i++, e++)
+    ((uint *) b[e / EPB]->data)[e % EPB] = l->lh.block[i];
+  for (i = 0; i < l->nrevoke; i++, e++)
+    ((uint *) b[e / EPB]->data)[e % EPB] = l->revoke[i];
+
+  n = nd;
+  for (i = 0; i < l->lh.n; i++, n++) {
+    b[n] = bread(l->dev, l->lh.block[i]); // cache block
+    to[n] = logblock(l, l->head + n);     // log block
+  }
+  if (n > 1)
+    bwritev(b + 1, to + 1, n - 1);
+  bwrite(b[0]);
+  for (i = 0; i < n; i++)
+    brelse(b[i]);
+
+  log.nlogged += l->lh.n;
+  l->head = (l->head + n) % l->size;
+  l->used += n;
+  l->seq++;
+}
+
+// The blocks just committed stay pinned until the next
+// checkpoint installs them; a block that was already
+// waiting needs just the one pin.
 static void
-write_log(void)
+keep(struct devlog *l)
 {
-  int tail;
+  struct buf *bp;
+  int i, j;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (i = 0; i < l->lh.n; i++) {
+    for (j = 0; j < l->ncp; j++)
+      if (l->cp[j] == l->lh.block[i])
+        break;
+    if (j < l->ncp) {
+      bp = bread(l->dev, l->lh.block[i]);
+      bunpin(bp);
+      brelse(bp);
+    } else {
+      l->cp[l->ncp++] = l->lh.block[i];
+    }
   }
+  l->lh.n = 0;
+  l->nrevoke = 0;
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  struct devlog *l;
+  int ncp = 0;
+
+  for (l = log.dl; l < log.dl+NDISK; l++) {
+    if (!l->live)
+      continue;
+    // data first, so that the metadata that
+    // points to it commits after it's on disk.
+    log.nordered += l->nord;
+    write_home(l->dev, l->ord, l->nord);
+    l->nord = 0;
+    if (l->lh.n > 0 || l->nrevoke > 0) {
+      write_record(l);
+      keep(l);
+    }
+    ncp += l->ncp;
+  }
+
+  for (l = log.dl; l < log.dl+NDISK; l++) {
+    if (!l->live)
+      continue;
+    // install once the cache or the journal is short of
+    // room for another transaction. NCKPT bounds the
+    // blocks waiting on all devices together.
+    if (ncp > NCKPT || l->size - l->used < log.size + MAXDESC) {
+      ncp -= l->ncp;
+      checkpoint(l);
+    }
+    // the blocks this transaction freed are free on disk now.
+    l->nfreed = 0;
+    l->freefull = 0;
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit()/write_record() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -214,23 +575,131 @@ commit()
 void
 log_write(struct buf *b)
 {
+  struct devlog *l = &log.dl[b->dev-1];
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (!l->live)
+    panic("log_write: no log");
+  if (logged() >= log.size)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
+  for (i = 0; i < l->lh.n; i++) {
+    if (l->lh.block[i] == b->blockno)   // log absorption
+      break;
+  }
+  l->lh.block[i] = b->blockno;
+  if (i == l->lh.n) {  // Add new block to log?
+    bpin(b);
+    l->lh.n++;
+  }
+  // freed and reused: the copy in this record is good.
+  for (i = 0; i < l->nrevoke; i++) {
+    if (l->revoke[i] == b->blockno) {
+      l->revoke[i] = l->revoke[--l->nrevoke];
       break;
+    }
+  }
+  release(&log.lock);
+}
+
+#ifndef LOGDATA
+// Is block b in l's current transaction or in the journal?
+// caller holds log.lock.
+static int
+journaled(struct devlog *l, uint b)
+{
+  int i;
+
+  for (i = 0; i < l->lh.n; i++)
+    if (l->lh.block[i] == b)
+      return 1;
+  for (i = 0; i < l->ncp; i++)
+    if (l->cp[i] == b)
+      return 1;
+  return 0;
+}
+#endif
+
+// Caller has modified b->data, a block of file data, and
+// is done with the buffer. Pin it, for commit() to write in
+// place ahead of the log. Data blocks that are already in
+// the journal stay there, since recovery would replay the
+// old copy over the new, and so does everything once blocks
+// freed by this transaction may have been reused.
+void
+log_write_data(struct buf *b)
+{
+#ifdef LOGDATA
+  log_write(b);
+#else
+  struct devlog *l = &log.dl[b->dev-1];
+  int i;
+
+  acquire(&log.lock);
+  if (!l->live)
+    panic("log_write_data: no log");
+  if (log.outstanding < 1)
+    panic("log_write_data outside of trans");
+  if (l->freefull || journaled(l, b->blockno)) {
+    release(&log.lock);
+    log_write(b);
+    return;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
+  for (i = 0; i < l->nord; i++)
+    if (l->ord[i] == b->blockno)
+      break;
+  if (i == l->nord) {
+    if (logged() >= log.size)
+      panic("too big a transaction");
+    l->ord[l->nord++] = b->blockno;
     bpin(b);
-    log.lh.n++;
   }
   release(&log.lock);
+#endif
+}
+
+// Block b of dev has been freed by the current transaction.
+// If the journal has a copy, revoke it, so that recovery
+// doesn't replay it over the block's next use.
+void
+log_free(int dev, uint b)
+{
+#ifndef LOGDATA
+  struct devlog *l = &log.dl[dev-1];
+  int i;
+
+  acquire(&log.lock);
+  if (l->nfreed < NFREED)
+    l->freed[l->nfreed++] = b;
+  else
+    l->freefull = 1;
+  if (journaled(l, b)) {
+    for (i = 0; i < l->nrevoke; i++)
+      if (l->revoke[i] == b)
+        break;
+    if (i == l->nrevoke)
+      l->revoke[l->nrevoke++] = b;
+  }
+  release(&log.lock);
+#endif
 }
 
+// May block b of dev be allocated? Not if the current
+// transaction freed it, since the last committed state may
+// still use it, and an in-place data write could clobber that.
+int
+log_reusable(int dev, uint b)
+{
+  struct devlog *l = &log.dl[dev-1];
+  int i, ok = 1;
+
+  acquire(&log.lock);
+  for (i = 0; i < l->nfreed; i++)
+    if (l->freed[i] == b)
+      ok = 0;
+  release(&log.lock);
+  return ok;
+}
@@ -24,6 +24,9 @@
 // virtio mmio interface
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
+// NDISK virtio disks, one page of registers each.
+#define VIRTIO(i) (VIRTIO0 + (i)*0x1000)
+#define VIRTIO_IRQ(i) (VIRTIO0_IRQ + (i))
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
@@ -65,3 +68,13 @@
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// one beyond the highest user address.
+#ifdef SUMCOPY
+// the kernel also maps its devices into each process's
+// page table (see kvmshare() in vm.c), and user memory
+// has to end below the lowest of them.
+#define MAXUVA PLIC
+#else
+#define MAXUVA TRAPFRAME
+#endif
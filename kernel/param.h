@@ -1,13 +1,25 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // unreferenced i-nodes to keep cached
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define NDISK         2  // virtio disks; disk i is device i+1
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define MAXOPBLOCKS  12  // max # of blocks any FS op but write writes
+#define LOGSIZE      240 // max blocks one transaction logs
+#define NDELAY       32  // most file blocks awaiting allocation; 0 for none
+#define NCKPT        LOGSIZE  // journaled blocks, on all disks, to cache before installing
+#define NBUFWORK     32   // unpinned buffers: commit's descriptors, FS calls' reads
+#define NBUF         (LOGSIZE+NCKPT+NDELAY+NBUFWORK)  // size of disk block cache
+#define FLUSHTICKS   30  // ticks before delayed blocks are written
+#define POLLUSEC     100 // default longest disk poll before sleeping
+#define MAXPOLLUSEC  1000 // longest diskpoll() may ask for
+#ifndef FSSIZE
+#define FSSIZE       10000   // default size of file system in blocks
+#endif
 #define MAXPATH      128   // maximum file path name
+#define NGETDENTS    16    // directory entries getdents() reads at a time
+#define MAXORDER     10    // largest physical allocation is 2^MAXORDER pages
+#define NSWAP        2048  // pages of swap space on disk
+#define SWAPLOW      8     // free pages to keep before allocating user memory
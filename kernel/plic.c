@@ -11,19 +11,27 @@
 void
 plicinit(void)
 {
+  int i;
+
   // set desired IRQ priorities non-zero (otherwise disabled).
   *(uint32*)(PLIC + UART0_IRQ*4) = 1;
-  *(uint32*)(PLIC + VIRTIO0_IRQ*4) = 1;
+  for(i = 0; i < NDISK; i++)
+    *(uint32*)(PLIC + VIRTIO_IRQ(i)*4) = 1;
 }
 
 void
 plicinithart(void)
 {
   int hart = cpuid();
+  uint32 en;
+  int i;
   
   // set enable bits for this hart's S-mode
-  // for the uart and virtio disk.
-  *(uint32*)PLIC_SENABLE(hart) = (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ);
+  // for the uart and virtio disks.
+  en = 1 << UART0_IRQ;
+  for(i = 0; i < NDISK; i++)
+    en |= 1 << VIRTIO_IRQ(i);
+  *(uint32*)PLIC_SENABLE(hart) = en;
 
   // set this hart's S-mode priority threshold to 0.
   *(uint32*)PLIC_SPRIORITY(hart) = 0;
@@ -15,10 +15,26 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// Address-space identifiers. Each process's satp carries an ASID,
+// so the TLB keeps its entries apart from the kernel's (ASID 0) and
+// other processes', and trap entry and return needn't flush it.
+// ASIDs are handed out in order; when they run out a new generation
+// starts, and each hart flushes its whole TLB before it next enters
+// user space, so no entry from the old generation survives.
+// A process holding an ASID from an old generation gets a new one
+// the next time it returns to user space.
+#define ASIDSHIFT 16
+uint64 nasid;       // ASIDs the hardware implements; 0 if none.
+uint64 nextasid;
+uint64 asidgen = 1;
+struct spinlock asid_lock;
+
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
+extern pagetable_t kernel_pagetable; // vm.c
 
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
@@ -51,11 +67,23 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  initlock(&asid_lock, "asid");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
       p->kstack = KSTACK((int) (p - proc));
   }
+
+  // find out how many ASID bits satp implements by writing
+  // all ones and reading back what stuck.
+  uint64 satp = r_satp();
+  w_satp(satp | (SATP_ASID_MASK << SATP_ASID_SHIFT));
+  nasid = ((r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK) + 1;
+  w_satp(satp);
+  sfence_vma();
+  if(nasid == 1)
+    nasid = 0;
+  nextasid = 1;
 }
 
 // Must be called with interrupts disabled,
@@ -102,6 +130,93 @@ allocpid()
   return pid;
 }
 
+// Return the satp value that installs p's user page table on this
+// hart, tagged with p's ASID. Allocates a fresh ASID if p has none
+// from the current generation, and flushes this hart's TLB if it
+// hasn't caught up with the current generation yet.
+// Must be called with interrupts disabled.
+uint64
+proc_satp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 asid;
+
+  if(nasid == 0)
+    return MAKE_SATP(p->pagetable);
+
+  acquire(&asid_lock);
+  if((p->asid >> ASIDSHIFT) != asidgen){
+    if(nextasid == nasid){
+      // out of ASIDs; start a new generation.
+      asidgen++;
+      nextasid = 1;
+    }
+    p->asid = (asidgen << ASIDSHIFT) | nextasid++;
+    p->asidharts = 0;
+  }
+  if(c->asidgen != asidgen){
+    // the TLB may hold entries tagged with ASIDs from an older
+    // generation, which are being handed out again.
+    sfence_vma();
+    c->asidgen = asidgen;
+  }
+  p->asidharts |= 1L << cpuid();
+  asid = p->asid & ((1L << ASIDSHIFT) - 1);
+  release(&asid_lock);
+
+  return MAKE_SATP_ASID(p->pagetable, asid);
+}
+
+// Discard stale TLB entries for p's user addresses [va, va+npages*PGSIZE),
+// which have just been unmapped. If p has only run on this hart
+// under its current ASID, flush just those pages here; otherwise
+// other harts may hold the translations too, so retire the ASID
+// and let p pick up a fresh one on its way back to user space.
+void
+proc_unmapped(struct proc *p, uint64 va, uint64 npages)
+{
+  uint64 asid;
+
+  if(nasid == 0 || npages == 0)
+    return; // userret flushes the whole TLB.
+
+  push_off();
+  acquire(&asid_lock);
+  if((p->asid >> ASIDSHIFT) == asidgen){
+    if(p->asidharts == (1L << cpuid())){
+      asid = p->asid & ((1L << ASIDSHIFT) - 1);
+      for(; npages > 0; npages--, va += PGSIZE)
+        sfence_vma_page(va, asid);
+    } else {
+      p->asid = 0;
+    }
+  }
+  release(&asid_lock);
+  pop_off();
+}
+
+#ifdef SUMCOPY
+// Run this hart on p's page table, which maps the kernel
+// as well as p's user memory.
+// Must be called with interrupts disabled.
+void
+proc_switchpt(struct proc *p)
+{
+  w_satp(proc_satp(p));
+  if(nasid == 0)
+    sfence_vma(); // the TLB may hold another process's entries.
+}
+
+// Switch this hart back to the kernel's own page table.
+void
+proc_switchkpt(void)
+{
+  w_satp(MAKE_SATP(kernel_pagetable));
+  if(nasid == 0)
+    sfence_vma();
+}
+#endif
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
@@ -162,12 +277,14 @@ freeproc(struct proc *p)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  p->asid = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kthread = 0;
   p->state = UNUSED;
 }
 
@@ -202,6 +319,17 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+#ifdef SUMCOPY
+  // map the kernel as well, so that the kernel can run
+  // on this page table.
+  if(kvmshare(pagetable, p->kstack) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+#endif
+
   return pagetable;
 }
 
@@ -212,6 +340,9 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+#ifdef SUMCOPY
+  kvmunshare(pagetable);
+#endif
   uvmfree(pagetable, sz);
 }
 
@@ -254,6 +385,22 @@ userinit(void)
   release(&p->lock);
 }
 
+// Start a kernel thread that runs fn(), which must not return.
+// It has no user memory and never returns to user space.
+void
+kthread(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->kthread = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -269,6 +416,7 @@ growproc(int n)
     }
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    proc_unmapped(p, PGROUNDUP(sz), (PGROUNDUP(p->sz) - PGROUNDUP(sz)) / PGSIZE);
   }
   p->sz = sz;
   return 0;
@@ -283,6 +431,9 @@ fork(void)
   struct proc *np;
   struct proc *p = myproc();
 
+  // allocproc() can't swap, since it holds np->lock.
+  swapreserve(SWAPLOW);
+
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
@@ -391,7 +542,7 @@ int
 wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -408,15 +559,18 @@ wait(uint64 addr)
         if(pp->state == ZOMBIE){
           // Found one.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
+          xstate = pp->xstate;
+          release(&pp->lock);
+          release(&wait_lock);
+          // copyout may sleep to bring the page back from swap,
+          // so it can't hold the locks. pp stays a zombie
+          // meanwhile, since only its parent reaps it.
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
             return -1;
-          }
+          acquire(&pp->lock);
           freeproc(pp);
           release(&pp->lock);
-          release(&wait_lock);
           return pid;
         }
         release(&pp->lock);
@@ -452,15 +606,24 @@ scheduler(void)
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
+    int found = 0;
     for(p = proc; p < &proc[NPROC]; p++) {
       acquire(&p->lock);
-      if(p->state == RUNNABLE) {
+      if(p->state == RUNNABLE && !p->swapping) {
         // Switch to chosen process.  It is the process's job
         // to release its lock and then reacquire it
         // before jumping back to us.
+        found = 1;
         p->state = RUNNING;
         c->proc = p;
+#ifdef SUMCOPY
+        proc_switchpt(p);
+#endif
         swtch(&c->context, &p->context);
+#ifdef SUMCOPY
+        // p's page table may be freed once p->lock is released.
+        proc_switchkpt();
+#endif
 
         // Process is done running for now.
         // It should have changed its p->state before coming back.
@@ -468,6 +631,11 @@ scheduler(void)
       }
       release(&p->lock);
     }
+
+    if(!found){
+      // nothing to run; do some background work.
+      kalloc_idle();
+    }
   }
 }
 
@@ -530,6 +698,18 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  myproc()->kthread();
+  panic("kthread returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
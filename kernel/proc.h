@@ -24,6 +24,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation this hart's TLB is clean for.
 };
 
 extern struct cpu cpus[NCPU];
@@ -91,6 +92,8 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int swapping;                // Being swapped out; don't run
+  int kpreempted;              // Preempted in the kernel; may be mid user copy
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -99,9 +102,12 @@ struct proc {
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  uint64 asid;                 // ASID generation<<ASIDSHIFT | ASID, or 0
+  uint64 asidharts;            // Harts that have run us with this ASID
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kthread)(void);       // Entry point, if a kernel thread
 };
@@ -0,0 +1,206 @@
+// Slab allocator for small kernel objects, on top of kalloc().
+//
+// A kmem_cache hands out objects of a single size. It carves them
+// from whole pages (slabs): each slab starts with a struct slab
+// header followed by as many objects as fit, and chains its free
+// objects through their first word. A slab with no objects in use
+// goes back to kfree().
+//
+// Each CPU keeps a handful of free objects per cache, so that most
+// allocations and frees don't touch the cache's lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NKMEMCACHE 8   // number of caches
+#define NCPUOBJ    8   // most free objects a CPU keeps per cache
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *prev;   // cache's list of slabs with free objects
+  struct slab *next;
+  void *free;          // chain of free objects
+  int inuse;           // objects not on the free chain
+};
+
+// objects start after the slab header.
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;           // object size
+  uint perslab;        // objects per slab
+  struct slab partial; // list of slabs with free objects
+  int nslab;           // slabs allocated
+
+  // per-CPU free objects; only touched with interrupts off.
+  struct {
+    int n;
+    void *obj[NCPUOBJ];
+  } cpu[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NKMEMCACHE];
+  int n;
+} kmem_caches;
+
+void
+slabinit(void)
+{
+  initlock(&kmem_caches.lock, "kmem_caches");
+}
+
+// Create a cache of size-byte objects.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 15) & ~15;
+  if(size < sizeof(void*) || SLABHDR + size > PGSIZE)
+    panic("kmem_cache_create: size");
+
+  acquire(&kmem_caches.lock);
+  if(kmem_caches.n >= NKMEMCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &kmem_caches.cache[kmem_caches.n++];
+  release(&kmem_caches.lock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  c->partial.prev = &c->partial;
+  c->partial.next = &c->partial;
+  c->nslab = 0;
+  return c;
+}
+
+static void
+slab_unlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+static void
+slab_link(struct kmem_cache *c, struct slab *s)
+{
+  s->next = c->partial.next;
+  s->prev = &c->partial;
+  c->partial.next->prev = s;
+  c->partial.next = s;
+}
+
+// Get a fresh slab from kalloc() and chain its objects.
+// Caller holds c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  for(i = c->perslab - 1; i >= 0; i--){
+    obj = (char*)s + SLABHDR + i*c->size;
+    *(void**)obj = s->free;
+    s->free = obj;
+  }
+  slab_link(c, s);
+  c->nslab++;
+  return s;
+}
+
+// Move up to half a CPU cache's worth of objects from
+// the slabs to this CPU. Interrupts are off.
+static void
+refill(struct kmem_cache *c, int id)
+{
+  struct slab *s;
+  void *obj;
+
+  acquire(&c->lock);
+  while(c->cpu[id].n < NCPUOBJ/2){
+    s = c->partial.next;
+    if(s == &c->partial && (s = slab_grow(c)) == 0)
+      break;
+    obj = s->free;
+    s->free = *(void**)obj;
+    s->inuse++;
+    if(s->free == 0)
+      slab_unlink(s);
+    c->cpu[id].obj[c->cpu[id].n++] = obj;
+  }
+  release(&c->lock);
+}
+
+// Return half of a full CPU cache to the slabs,
+// freeing slabs that become empty. Interrupts are off.
+static void
+drain(struct kmem_cache *c, int id)
+{
+  struct slab *s;
+  void *obj;
+
+  acquire(&c->lock);
+  while(c->cpu[id].n > NCPUOBJ/2){
+    obj = c->cpu[id].obj[--c->cpu[id].n];
+    s = (struct slab*)PGROUNDDOWN((uint64)obj);
+    if(s->cache != c)
+      panic("kmem_cache_free: wrong cache");
+    if(s->free == 0)
+      slab_link(c, s);
+    *(void**)obj = s->free;
+    s->free = obj;
+    if(--s->inuse == 0){
+      slab_unlink(s);
+      c->nslab--;
+      kfree(s);
+    }
+  }
+  release(&c->lock);
+}
+
+// Allocate an object from cache c.
+// Returns 0 if out of memory. The object is not zeroed.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *obj = 0;
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->cpu[id].n == 0)
+    refill(c, id);
+  if(c->cpu[id].n > 0)
+    obj = c->cpu[id].obj[--c->cpu[id].n];
+  pop_off();
+  return obj;
+}
+
+// Free an object that kmem_cache_alloc(c) returned.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->cpu[id].n == NCPUOBJ)
+    drain(c, id);
+  c->cpu[id].obj[c->cpu[id].n++] = obj;
+  pop_off();
+}
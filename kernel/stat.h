@@ -9,3 +9,12 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+// A directory entry as getdents() returns it.
+struct dent {
+  uint ino;    // Inode number
+  short type;  // Type of file
+  short nlink; // Number of links to file
+  uint64 size; // Size of file in bytes
+  char name[15]; // DIRSIZ bytes and a NUL
+};
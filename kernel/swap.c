@@ -0,0 +1,240 @@
+// Swap space.
+//
+// When memory runs short, user pages are written to a region of
+// the disk that mkfs reserves after the file system, and read back
+// when the process next touches them.
+//
+// A swapped-out page keeps its PTE, with PTE_V clear, PTE_SWAP set,
+// and the swap slot number where the physical page number would be.
+// Only the process that owns the page table swaps pages in.
+//
+// Victims are found by a clock sweep over the user pages of the
+// processes that aren't running: a page whose accessed bit is set
+// gets the bit cleared and a second chance. While the sweep looks
+// at a process, p->swapping keeps the scheduler from running it,
+// so its memory can't change underfoot. A process that was
+// preempted in the kernel is left alone, since it may have looked
+// up a user page and not yet copied to or from it; one that's
+// sleeping, or was preempted in user mode, can't be in a copy.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "iosched.h"
+#include "defs.h"
+
+#define PTE2SLOT(pte) ((pte) >> 10)
+#define SLOT2PTE(s)   ((uint64)(s) << 10)
+
+extern struct proc proc[NPROC];
+
+struct {
+  struct spinlock lock;
+  uint start;          // first disk block of swap space
+  int nslot;           // pages of swap space
+  uchar used[NSWAP/8]; // bitmap of slots in use
+} swap;
+
+// the clock hand; the sleep lock lets one process sweep at a time.
+struct {
+  struct sleeplock lock;
+  int proc;    // index into proc[]
+  uint64 va;   // next page of that process to look at
+} clock;
+
+// Called by fsinit() with the swap area from the superblock.
+void
+swapinit(uint start, uint npages)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&clock.lock, "clock");
+  if(npages > NSWAP)
+    npages = NSWAP;
+  swap.start = start;
+  swap.nslot = npages;
+}
+
+static int
+slotalloc(void)
+{
+  int s;
+
+  acquire(&swap.lock);
+  for(s = 0; s < swap.nslot; s++){
+    if((swap.used[s/8] & (1 << (s%8))) == 0){
+      swap.used[s/8] |= 1 << (s%8);
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+static void
+slotfree(int s)
+{
+  acquire(&swap.lock);
+  if((swap.used[s/8] & (1 << (s%8))) == 0)
+    panic("slotfree");
+  swap.used[s/8] &= ~(1 << (s%8));
+  release(&swap.lock);
+}
+
+static void
+slotrw(int s, void *pa, int write)
+{
+  struct ioreq r;
+  uint blockno = swap.start + s * (PGSIZE / BSIZE);
+
+  iostart(&r, ROOTDEV, blockno, write);
+  virtio_disk_rwpage(blockno, pa, write);
+  iodone(&r);
+}
+
+// Keep the scheduler away from p while the clock looks at it.
+// Fails if p is running, may be in the middle of a user copy,
+// or isn't a live process.
+static int
+pin(struct proc *p)
+{
+  int ok;
+
+  acquire(&p->lock);
+  ok = p != myproc() &&
+       (p->state == SLEEPING || (p->state == RUNNABLE && !p->kpreempted));
+  if(ok)
+    p->swapping = 1;
+  release(&p->lock);
+  return ok;
+}
+
+static void
+unpin(struct proc *p)
+{
+  acquire(&p->lock);
+  p->swapping = 0;
+  release(&p->lock);
+}
+
+// Write the page mapped by *pte at va in pinned process p to swap.
+static int
+evict(struct proc *p, uint64 va, pte_t *pte)
+{
+  uint64 pa;
+  int s;
+
+  if((s = slotalloc()) < 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  *pte = SLOT2PTE(s) | (PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D)) | PTE_SWAP;
+  proc_unmapped(p, va, 1);
+  slotrw(s, (void*)pa, 1);
+  kfree((void*)pa);
+  return 0;
+}
+
+// Move one user page out to swap.
+// Returns 0, or -1 if there is no victim or no swap space.
+int
+swapout(void)
+{
+  struct proc *p;
+  pte_t *pte;
+  uint64 va;
+  int n, r;
+
+  if(swap.nslot == 0)
+    return -1;
+
+  acquiresleep(&clock.lock);
+  // two trips round every process, since the first
+  // may only clear accessed bits.
+  for(n = 0; n <= 2*NPROC; n++){
+    p = &proc[clock.proc];
+    if(pin(p)){
+      for(va = clock.va; va < p->sz; va += PGSIZE){
+        pte = walk(p->pagetable, va, 0);
+        if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+          continue;
+        if(*pte & PTE_A){
+          *pte &= ~PTE_A;
+          continue;
+        }
+        clock.va = va + PGSIZE;
+        r = evict(p, va, pte);
+        unpin(p);
+        releasesleep(&clock.lock);
+        return r;
+      }
+      unpin(p);
+    }
+    clock.proc = (clock.proc + 1) % NPROC;
+    clock.va = 0;
+  }
+  releasesleep(&clock.lock);
+  return -1;
+}
+
+// Swap pages out until at least n pages are free, or
+// there's nothing left to swap. Must not hold spinlocks.
+void
+swapreserve(int n)
+{
+  while(kfreepages() < n && swapout() == 0)
+    ;
+}
+
+// Make room for a user page and allocate it.
+void *
+kalloc_user(void)
+{
+  swapreserve(SWAPLOW);
+  return kalloc();
+}
+
+// Bring the page at va back from swap, in the current
+// process's page table or one that nothing else can see.
+// Returns its physical address, or 0 if va isn't swapped out
+// or there's no memory.
+uint64
+swapin(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  char *mem;
+  int s;
+
+  if(va >= MAXVA)
+    return 0;
+  va = PGROUNDDOWN(va);
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_SWAP|PTE_U)) != (PTE_SWAP|PTE_U))
+    return 0;
+  if((mem = kalloc_user()) == 0)
+    return 0;
+  s = PTE2SLOT(*pte);
+  slotrw(s, mem, 0);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V | PTE_A;
+  slotfree(s);
+  return (uint64)mem;
+}
+
+// Read the swapped-out page named by pte into pa,
+// leaving the swap copy in place.
+void
+swapread(pte_t pte, void *pa)
+{
+  slotrw(PTE2SLOT(pte), pa, 0);
+}
+
+// Release the swap space named by pte.
+void
+swapfree(pte_t pte)
+{
+  slotfree(PTE2SLOT(pte));
+}
@@ -101,6 +101,21 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_dcachestat(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_iosched(void);
+extern uint64 sys_iostat(void);
+extern uint64 sys_diskpoll(void);
+extern uint64 sys_mount(void);
+extern uint64 sys_logstat(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_lseek(void);
+extern uint64 sys_sendfile(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +141,21 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_memstat] sys_memstat,
+[SYS_dcachestat] sys_dcachestat,
+[SYS_getdents] sys_getdents,
+[SYS_fsync]   sys_fsync,
+[SYS_iosched] sys_iosched,
+[SYS_iostat]  sys_iostat,
+[SYS_diskpoll] sys_diskpoll,
+[SYS_mount]   sys_mount,
+[SYS_logstat] sys_logstat,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_lseek]   sys_lseek,
+[SYS_sendfile] sys_sendfile,
 };
 
 void
@@ -20,3 +20,18 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_memstat 22
+#define SYS_dcachestat 23
+#define SYS_getdents 24
+#define SYS_fsync  25
+#define SYS_iosched 26
+#define SYS_iostat 27
+#define SYS_diskpoll 28
+#define SYS_mount  29
+#define SYS_logstat 30
+#define SYS_pread  31
+#define SYS_pwrite 32
+#define SYS_readv  33
+#define SYS_writev 34
+#define SYS_lseek  35
+#define SYS_sendfile 36
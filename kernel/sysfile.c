@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "iosched.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -94,6 +95,123 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// pread(fd, buf, n, off) and pwrite(fd, buf, n, off) read and
+// write at offset off of a file, leaving its offset alone.
+// Files can't have holes, so pwrite() past the end fails.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
+// Fetch the array of n struct iovec at user address addr
+// into iov. Fails if there are too many, or the lengths
+// add up to more than an int holds.
+static int
+fetchiov(uint64 addr, int n, struct iovec *iov)
+{
+  uint tot = 0;
+  int i;
+
+  if(n < 0 || n > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, n*sizeof(iov[0])) < 0)
+    return -1;
+  for(i = 0; i < n; i++){
+    tot += iov[i].iov_len;
+    if(iov[i].iov_len > 0x7fffffff || tot > 0x7fffffff)
+      return -1;
+  }
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int n;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0 || fetchiov(p, n, iov) < 0)
+    return -1;
+  return filereadv(f, iov, n, -1);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int n;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0 || fetchiov(p, n, iov) < 0)
+    return -1;
+  return filewritev(f, iov, n, -1);
+}
+
+// lseek(fd, off, whence): see fileseek(). A file's offset can't
+// move past its end.
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  argint(1, &off);
+  argint(2, &whence);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0)
+    return -1;
+  return filesend(out, in, n);
+}
+
 uint64
 sys_close(void)
 {
@@ -119,6 +237,69 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  uint64 addr; // user pointer to array of struct dent
+  int n;
+
+  argaddr(1, &addr);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filegetdents(f, addr, n);
+}
+
+uint64
+sys_iosched(void)
+{
+  int policy;
+
+  argint(0, &policy);
+  return iosched(policy);
+}
+
+uint64
+sys_iostat(void)
+{
+  uint64 addr;
+  struct iostat st;
+
+  argaddr(0, &addr);
+  iostat(&st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_diskpoll(void)
+{
+  int mode, usec;
+
+  argint(0, &mode);
+  argint(1, &usec);
+  return virtio_disk_poll(mode, usec);
+}
+
+// Write f's data and everything logged so far to disk.
+// Fails if some of f's data didn't fit on the disk.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+  int r;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_INODE)
+    return -1;
+  r = iflush(f->ip);
+  log_sync();
+  return r;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -169,27 +350,10 @@ bad:
   return -1;
 }
 
-// Is the directory dp empty except for "." and ".." ?
-static int
-isdirempty(struct inode *dp)
-{
-  int off;
-  struct dirent de;
-
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-}
-
 uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
@@ -214,14 +378,12 @@ sys_unlink(void)
 
   if(ip->nlink < 1)
     panic("unlink: nlink < 1");
-  if(ip->type == T_DIR && !isdirempty(ip)){
+  if(ip->type == T_DIR && (!dirempty(ip) || ismountpoint(ip))){
     iunlockput(ip);
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -262,7 +424,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0){
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0){
     iunlockput(dp);
     return 0;
   }
@@ -431,6 +593,32 @@ sys_chdir(void)
   return 0;
 }
 
+// Mount the file system on disk dev on an empty directory.
+uint64
+sys_mount(void)
+{
+  char path[MAXPATH];
+  struct inode *ip;
+  int dev;
+
+  argint(0, &dev);
+  begin_op();
+  if(argstr(1, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  ilock(ip);
+  if(ip->type != T_DIR || !dirempty(ip) || mount(dev, ip) < 0){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+  // the mount table keeps the reference.
+  iunlock(ip);
+  end_op();
+  return 0;
+}
+
 uint64
 sys_exec(void)
 {
@@ -503,3 +691,34 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// copy the directory entry cache's hit, negative hit
+// and miss counts to the user uint array at addr.
+uint64
+sys_dcachestat(void)
+{
+  uint64 addr;
+  uint st[3];
+
+  argaddr(0, &addr);
+  dcache_stat(st);
+  if(copyout(myproc()->pagetable, addr, (char*)st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// copy the log's commit count, blocks logged, transaction
+// size, maxopblocks and data blocks written in place to the
+// user uint array at addr.
+uint64
+sys_logstat(void)
+{
+  uint64 addr;
+  uint st[7];
+
+  argaddr(0, &addr);
+  log_stat(st);
+  if(copyout(myproc()->pagetable, addr, (char*)st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
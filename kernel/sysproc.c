@@ -89,3 +89,19 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// copy the number of free blocks of 2^k pages in the
+// physical page allocator, for k = 0..MAXORDER, to
+// the user int array at addr.
+uint64
+sys_memstat(void)
+{
+  uint64 addr;
+  int nfree[MAXORDER+1];
+
+  argaddr(0, &addr);
+  kmemstat(nfree);
+  if(copyout(myproc()->pagetable, addr, (char*)nfree, sizeof(nfree)) < 0)
+    return -1;
+  return 0;
+}
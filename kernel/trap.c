@@ -10,6 +10,9 @@ struct spinlock tickslock;
 uint ticks;
 
 extern char trampoline[], uservec[], userret[];
+#ifdef SUMCOPY
+extern char copyuser_start[], copyuser_end[], copyuser_fault[]; // copyuser.S
+#endif
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
@@ -67,6 +70,16 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault; all right if the page is just in swap.
+    uint64 scause = r_scause();
+    uint64 stval = r_stval();
+    intr_on();
+    if(swapin(p->pagetable, stval) == 0){
+      printf("usertrap(): page fault scause %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, stval);
+      setkilled(p);
+    }
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -120,7 +133,7 @@ usertrapret(void)
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = proc_satp(p);
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -135,6 +148,7 @@ void
 kerneltrap()
 {
   int which_dev = 0;
+  struct proc *p;
   uint64 sepc = r_sepc();
   uint64 sstatus = r_sstatus();
   uint64 scause = r_scause();
@@ -144,15 +158,40 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
+#ifdef SUMCOPY
+  // don't let another kernel thread run with user memory
+  // accessible if this trap yields; w_sstatus() below
+  // restores it.
+  w_sstatus(sstatus & ~SSTATUS_SUM);
+#endif
+
   if((which_dev = devintr()) == 0){
+#ifdef SUMCOPY
+    // a bad user address in copyuser.S: make the copy fail.
+    if((scause == 13 || scause == 15) &&
+       sepc >= (uint64)copyuser_start && sepc < (uint64)copyuser_end){
+      w_sepc((uint64)copyuser_fault);
+      w_sstatus(sstatus);
+      return;
+    }
+#endif
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  if(which_dev == 2 && (p = myproc()) != 0 && p->state == RUNNING){
+    // p may be between finding a user page and copying
+    // to it; swap mustn't take the page meanwhile.
+    acquire(&p->lock);
+    p->kpreempted = 1;
+    release(&p->lock);
     yield();
+    acquire(&p->lock);
+    p->kpreempted = 0;
+    release(&p->lock);
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -188,8 +227,8 @@ devintr()
 
     if(irq == UART0_IRQ){
       uartintr();
-    } else if(irq == VIRTIO0_IRQ){
-      virtio_disk_intr();
+    } else if(irq >= VIRTIO_IRQ(0) && irq < VIRTIO_IRQ(NDISK)){
+      virtio_disk_intr(irq - VIRTIO0_IRQ);
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
@@ -47,7 +47,11 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 32
+
+// most data descriptors in one disk request, so that
+// two of the largest requests can be in flight at once.
+#define MAXSEG (NUM/2 - 2)
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -60,11 +64,13 @@ struct virtq_desc {
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
 
 // the (entire) avail ring, from the spec.
+#define VRING_AVAIL_F_NO_INTERRUPT 1 // without EVENT_IDX: don't interrupt
+
 struct virtq_avail {
-  uint16 flags; // always zero
+  uint16 flags; // VRING_AVAIL_F_NO_INTERRUPT, or zero
   uint16 idx;   // driver will write ring[idx] next
   uint16 ring[NUM]; // descriptor numbers of chain heads
-  uint16 unused;
+  uint16 used_event; // with EVENT_IDX: interrupt when used idx passes this
 };
 
 // one entry in the "used" ring, with which the
@@ -78,6 +84,7 @@ struct virtq_used {
   uint16 flags; // always zero
   uint16 idx;   // device increments when it adds a ring[] entry
   struct virtq_used_elem ring[NUM];
+  uint16 avail_event; // with EVENT_IDX: notify when avail idx passes this
 };
 
 // these are specific to virtio block devices, e.g. disks,
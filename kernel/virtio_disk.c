@@ -4,6 +4,9 @@
 //
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
 //
+// there may be up to NDISK disks, on virtio-mmio-bus.0 and up;
+// disk i is device number i+1. disk 0 holds the root file system.
+//
 
 #include "types.h"
 #include "riscv.h"
@@ -15,11 +18,15 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "iosched.h"
 
-// the address of virtio mmio register r.
-#define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
+// the address of virtio mmio register r of disk d.
+#define R(d, r) ((volatile uint32 *)((d)->base + (r)))
 
 static struct disk {
+  uint64 base;     // mmio registers
+  int present;     // found a disk at base?
+
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
   // disk operations. there are NUM descriptors.
@@ -41,12 +48,16 @@ static struct disk {
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
+  int event_idx;   // negotiated VIRTIO_RING_F_EVENT_IDX?
+  int inflight;    // requests the device hasn't finished
+  int npoll;       // waiters polling, who want no interrupts
+  uint16 kick_idx; // avail index when the device was last told
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    int *busy;   // cleared, and woken, when the operation finishes
     char status;
   } info[NUM];
 
@@ -55,110 +66,151 @@ static struct disk {
   struct virtio_blk_req ops[NUM];
   
   struct spinlock vdisk_lock;
-  
-} disk;
+} disks[NDISK];
+
+// how the driver waits for single-block requests, on all disks.
+static struct {
+  struct spinlock lock;
+  int mode;         // DISKPOLL_*
+  uint64 spin;      // longest to spin, in time CSR units
+} poll;
+
+// the disk that holds device dev.
+static struct disk*
+getdisk(uint dev)
+{
+  if(dev < 1 || dev > NDISK || !disks[dev-1].present)
+    panic("virtio disk: no such device");
+  return &disks[dev-1];
+}
 
-void
-virtio_disk_init(void)
+static void
+disk_init(struct disk *d)
 {
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
+  initlock(&d->vdisk_lock, "virtio_disk");
 
-  if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
-     *R(VIRTIO_MMIO_VERSION) != 2 ||
-     *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
-     *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
-    panic("could not find virtio disk");
+  if(*R(d, VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+     *R(d, VIRTIO_MMIO_VERSION) != 2 ||
+     *R(d, VIRTIO_MMIO_DEVICE_ID) != 2 ||
+     *R(d, VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
+    // nothing plugged into this slot.
+    return;
   }
+  d->present = 1;
   
   // reset device
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // set ACKNOWLEDGE status bit
   status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // set DRIVER status bit
   status |= VIRTIO_CONFIG_S_DRIVER;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // negotiate features
-  uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  uint64 features = *R(d, VIRTIO_MMIO_DEVICE_FEATURES);
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
-  *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  *R(d, VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  d->event_idx = (features >> VIRTIO_RING_F_EVENT_IDX) & 1;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // re-read status to ensure FEATURES_OK is set.
-  status = *R(VIRTIO_MMIO_STATUS);
+  status = *R(d, VIRTIO_MMIO_STATUS);
   if(!(status & VIRTIO_CONFIG_S_FEATURES_OK))
     panic("virtio disk FEATURES_OK unset");
 
   // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
+  *R(d, VIRTIO_MMIO_QUEUE_SEL) = 0;
 
   // ensure queue 0 is not in use.
-  if(*R(VIRTIO_MMIO_QUEUE_READY))
+  if(*R(d, VIRTIO_MMIO_QUEUE_READY))
     panic("virtio disk should not be ready");
 
   // check maximum queue size.
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+  uint32 max = *R(d, VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
     panic("virtio disk has no queue 0");
   if(max < NUM)
     panic("virtio disk max queue too short");
 
   // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
-  if(!disk.desc || !disk.avail || !disk.used)
+  d->desc = kalloc();
+  d->avail = kalloc();
+  d->used = kalloc();
+  if(!d->desc || !d->avail || !d->used)
     panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
+  memset(d->desc, 0, PGSIZE);
+  memset(d->avail, 0, PGSIZE);
+  memset(d->used, 0, PGSIZE);
 
   // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  *R(d, VIRTIO_MMIO_QUEUE_NUM) = NUM;
 
   // write physical addresses.
-  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
-  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)disk.desc >> 32;
-  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)disk.avail;
-  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)disk.avail >> 32;
-  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)disk.used;
-  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)disk.used >> 32;
+  *R(d, VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)d->desc;
+  *R(d, VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)d->desc >> 32;
+  *R(d, VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)d->avail;
+  *R(d, VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)d->avail >> 32;
+  *R(d, VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)d->used;
+  *R(d, VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)d->used >> 32;
 
   // queue is ready.
-  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
+  *R(d, VIRTIO_MMIO_QUEUE_READY) = 0x1;
 
   // all NUM descriptors start out unused.
   for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+    d->free[i] = 1;
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
+
+  // plic.c and trap.c arrange for interrupts from VIRTIO_IRQ(i).
+}
+
+void
+virtio_disk_init(void)
+{
+  int i;
+
+  initlock(&poll.lock, "diskpoll");
+  poll.mode = DISKPOLL_READS;
+  poll.spin = POLLUSEC * 10;  // the time CSR counts at 10 MHz
+
+  for(i = 0; i < NDISK; i++){
+    disks[i].base = VIRTIO(i);
+    disk_init(&disks[i]);
+  }
+  if(!disks[0].present)
+    panic("could not find virtio disk");
+}
 
-  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+// is there a disk for device dev?
+int
+virtio_disk_present(uint dev)
+{
+  return dev >= 1 && dev <= NDISK && disks[dev-1].present;
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct disk *d)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(d->free[i]){
+      d->free[i] = 0;
       return i;
     }
   }
@@ -167,28 +219,28 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct disk *d, int i)
 {
   if(i >= NUM)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(d->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  d->desc[i].addr = 0;
+  d->desc[i].len = 0;
+  d->desc[i].flags = 0;
+  d->desc[i].next = 0;
+  d->free[i] = 1;
+  wakeup(&d->free[0]);
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct disk *d, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = d->desc[i].flags;
+    int nxt = d->desc[i].next;
+    free_desc(d, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -196,46 +248,75 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(struct disk *d, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+  for(int i = 0; i < n; i++){
+    idx[i] = alloc_desc(d);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(d, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// has the avail or used index moved from old to new past event?
+// from the spec.
+static int
+need_event(uint16 event, uint16 new, uint16 old)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  return (uint16)(new - event - 1) < (uint16)(new - old);
+}
 
-  acquire(&disk.vdisk_lock);
+// tell the device about the requests started since the last
+// disk_kick(), unless, with EVENT_IDX, it has said it will
+// find them without being told.
+// caller holds vdisk_lock.
+static void
+disk_kick(struct disk *d)
+{
+  uint16 old = d->kick_idx;
 
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  if(old == d->avail->idx)
+    return;
+  d->kick_idx = d->avail->idx;
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+  __sync_synchronize();
+
+  if(d->event_idx && !need_event(d->used->avail_event, d->avail->idx, old))
+    return;
+  *R(d, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
+// start a request to read or write n segments of len bytes,
+// at data[0..n-1], to or from consecutive disk sectors
+// starting at sector. virtio_disk_intr() clears *busy when
+// the request finishes. the device doesn't look for it
+// until disk_kick(). caller holds vdisk_lock.
+static void
+disk_start(struct disk *d, uint64 sector, void **data, int n, uint len, int write, int *busy)
+{
+  int idx[MAXSEG+2];
+  int i;
+
+  if(n < 1 || n > MAXSEG)
+    panic("disk_start");
+
+  // the spec's Section 5.2 says that block operations use
+  // a descriptor for type/reserved/sector, one or more for
+  // the data, and one for a 1-byte status result.
+  while(alloc_descs(d, idx, n+2) < 0){
+    disk_kick(d);  // so that requests started already can finish
+    sleep(&d->free[0], &d->vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &d->ops[idx[0]];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -244,57 +325,217 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
+  d->desc[idx[0]].addr = (uint64) buf0;
+  d->desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  d->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  d->desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(i = 1; i <= n; i++){
+    d->desc[idx[i]].addr = (uint64) data[i-1];
+    d->desc[idx[i]].len = len;
+    if(write)
+      d->desc[idx[i]].flags = 0; // device reads data
+    else
+      d->desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes data
+    d->desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    d->desc[idx[i]].next = idx[i+1];
+  }
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  d->info[idx[0]].status = 0xff; // device writes 0 on success
+  d->desc[idx[n+1]].addr = (uint64) &d->info[idx[0]].status;
+  d->desc[idx[n+1]].len = 1;
+  d->desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  d->desc[idx[n+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record the busy flag for virtio_disk_intr().
+  *busy = 1;
+  d->info[idx[0]].busy = busy;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  d->avail->ring[d->avail->idx % NUM] = idx[0];
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  d->avail->idx += 1; // not % NUM ...
+  d->inflight++;
+}
+
+// handle requests the device has finished: clear their
+// busy flags and wake up their waiters.
+// caller holds vdisk_lock.
+static void
+disk_complete(struct disk *d)
+{
+again:
+  // the device increments d->used->idx when it
+  // adds an entry to the used ring.
+
+  while(d->used_idx != d->used->idx){
+    __sync_synchronize();
+    int id = d->used->ring[d->used_idx % NUM].id;
 
+    if(d->info[id].status != 0)
+      panic("virtio_disk_intr status");
+
+    int *busy = d->info[id].busy;
+    d->info[id].busy = 0;
+    free_chain(d, id);
+    *busy = 0;   // disk is done with the data
+    wakeup(busy);
+
+    d->used_idx += 1;
+    d->inflight--;
+  }
+
+  if(d->event_idx){
+    // with many requests in flight, ask for the next interrupt
+    // only once about half of them have finished; while someone
+    // polls, at a point the used index can't reach.
+    if(d->npoll > 0)
+      d->avail->used_event = d->used_idx + NUM;
+    else
+      d->avail->used_event = d->used_idx + (d->inflight > 0 ? (d->inflight - 1) / 2 : 0);
+    __sync_synchronize();
+    // look again, in case one finished before used_event was set.
+    if(d->used_idx != d->used->idx)
+      goto again;
+  }
+}
+
+// start or stop polling, which turns the device's completion
+// interrupts off while anyone polls. the interrupts are only
+// off as a hint, so finished requests are reaped either way.
+// caller holds vdisk_lock.
+static void
+disk_polling(struct disk *d, int on)
+{
+  d->npoll += on ? 1 : -1;
+  if(!d->event_idx)
+    d->avail->flags = d->npoll > 0 ? VRING_AVAIL_F_NO_INTERRUPT : 0;
   __sync_synchronize();
+  // sets used_event; and reaps anything that finished
+  // while interrupts were off.
+  disk_complete(d);
+}
+
+// wait for a request to finish. first spin on the used ring
+// for up to spin time CSR units, which for a fast request saves
+// the interrupt and two context switches; if spin is 0, or
+// that's not long enough, sleep until virtio_disk_intr() says
+// it has finished. the spin lets interrupts in between looks.
+// caller holds vdisk_lock.
+static void
+disk_wait(struct disk *d, int *busy, uint64 spin)
+{
+  uint64 t0;
+
+  if(spin > 0 && *busy == 1){
+    disk_polling(d, 1);
+    t0 = r_time();
+    while(*busy == 1 && r_time() - t0 < spin){
+      release(&d->vdisk_lock);
+      acquire(&d->vdisk_lock);
+      disk_complete(d);
+    }
+    disk_polling(d, 0);
+  }
+  while(*busy == 1) {
+    sleep(busy, &d->vdisk_lock);
+  }
+}
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+// read or write len bytes at data, starting at sector.
+static void
+disk_rw(struct disk *d, uint64 sector, void *data, uint len, int write, int *busy, uint64 spin)
+{
+  acquire(&d->vdisk_lock);
+  disk_start(d, sector, &data, 1, len, write, busy);
+  disk_kick(d);
+  disk_wait(d, busy, spin);
+  release(&d->vdisk_lock);
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  uint64 spin = 0;
+
+  acquire(&poll.lock);
+  if(poll.mode == DISKPOLL_ALL || (poll.mode == DISKPOLL_READS && !write))
+    spin = poll.spin;
+  release(&poll.lock);
+  disk_rw(getdisk(b->dev), b->blockno * (BSIZE / 512), b->data, BSIZE, write, &b->disk, spin);
+}
+
+// set how the driver waits for single-block requests, and
+// how many microseconds, up to MAXPOLLUSEC, it spins before
+// sleeping, if usec >= 0. returns the old mode, or -1.
+// applies to all disks; requests already waiting keep the
+// old setting.
+int
+virtio_disk_poll(int mode, int usec)
+{
+  int old;
+
+  if(mode < DISKPOLL_OFF || mode > DISKPOLL_ALL)
+    return -1;
+  if(usec > MAXPOLLUSEC)
+    usec = MAXPOLLUSEC;
+  acquire(&poll.lock);
+  old = poll.mode;
+  poll.mode = mode;
+  if(usec >= 0)
+    poll.spin = (uint64)usec * 10;
+  release(&poll.lock);
+  return old;
+}
+
+// write the data of buf b[i] to disk block blockno[i], for i
+// in 0..n-1, and wait until all of it is written. runs of
+// consecutive block numbers go to the device as one request.
+// the bufs all belong to the same device.
+void
+virtio_disk_writev(struct buf **b, uint *blockno, int n)
+{
+  struct disk *d = getdisk(b[0]->dev);
+  void *data[MAXSEG];
+  int i, j;
+
+  acquire(&d->vdisk_lock);
+  for(i = 0; i < n; i = j){
+    data[0] = b[i]->data;
+    for(j = i + 1; j < n && j - i < MAXSEG && blockno[j] == blockno[j-1] + 1; j++){
+      data[j - i] = b[j]->data;
+      b[j]->disk = 0;
+    }
+    disk_start(d, blockno[i] * (BSIZE / 512), data, j - i, BSIZE, 1, &b[i]->disk);
   }
+  // one notification for the whole batch.
+  disk_kick(d);
+  for(i = 0; i < n; i++)
+    disk_wait(d, &b[i]->disk, 0);
+  release(&d->vdisk_lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+// read or write the page at pa, starting at block blockno,
+// of the root disk, without going through the buffer cache.
+// used for swap.
+void
+virtio_disk_rwpage(uint blockno, void *pa, int write)
+{
+  int busy;
 
-  release(&disk.vdisk_lock);
+  disk_rw(getdisk(ROOTDEV), blockno * (BSIZE / 512), pa, PGSIZE, write, &busy, 0);
 }
 
+// interrupt from disk i.
 void
-virtio_disk_intr()
+virtio_disk_intr(int i)
 {
-  acquire(&disk.vdisk_lock);
+  struct disk *d = &disks[i];
+
+  acquire(&d->vdisk_lock);
 
   // the device won't raise another interrupt until we tell it
   // we've seen this interrupt, which the following line does.
@@ -302,26 +543,11 @@ virtio_disk_intr()
   // the "used" ring, in which case we may process the new
   // completion entries in this interrupt, and have nothing to do
   // in the next interrupt, which is harmless.
-  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  *R(d, VIRTIO_MMIO_INTERRUPT_ACK) = *R(d, VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
-  // adds an entry to the used ring.
-
-  while(disk.used_idx != disk.used->idx){
-    __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
-
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
-
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
-
-    disk.used_idx += 1;
-  }
+  disk_complete(d);
 
-  release(&disk.vdisk_lock);
+  release(&d->vdisk_lock);
 }
@@ -27,8 +27,8 @@ kvmmake(void)
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
-  // virtio mmio disk interface
-  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  // virtio mmio disk interfaces
+  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, NDISK*PGSIZE, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
@@ -93,9 +93,8 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
     if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
@@ -179,6 +178,15 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
       panic("uvmunmap: walk");
+    if((*pte & PTE_V) == 0 && (*pte & PTE_SWAP) && do_free){
+      swapfree(*pte);
+      *pte = 0;
+      continue;
+    }
+    if(*pte == PTE_GUARD){
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
       panic("uvmunmap: not mapped");
     if(PTE_FLAGS(*pte) == PTE_V)
@@ -197,10 +205,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -214,8 +221,7 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -230,15 +236,17 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   if(newsz < oldsz)
     return oldsz;
+  if(newsz > MAXUVA)
+    return 0;
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    swapreserve(SWAPLOW);
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -311,15 +319,29 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
+    // allocate before looking at the PTE, since making
+    // room may swap out the parent's pages.
+    if((mem = kalloc_user()) == 0)
+      goto err;
     if((pte = walk(old, i, 0)) == 0)
       panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
+    if(*pte == PTE_GUARD){
+      kfree(mem);
+      if((pte = walk(new, i, 1)) == 0)
+        goto err;
+      *pte = PTE_GUARD;
+      continue;
+    }
+    if(*pte & PTE_SWAP){
+      flags = (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V;
+      swapread(*pte, mem);
+    } else {
+      if((*pte & PTE_V) == 0)
+        panic("uvmcopy: page not present");
+      pa = PTE2PA(*pte);
+      flags = PTE_FLAGS(*pte);
+      memmove(mem, (char*)pa, PGSIZE);
+    }
     if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
       kfree(mem);
       goto err;
@@ -345,6 +367,96 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Free the page at va and leave a PTE that faults on any
+// access, even from the kernel. Used by exec for the user
+// stack guard page when SUM lets the kernel reach pages
+// that aren't PTE_U.
+void
+uvmguard(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  uvmunmap(pagetable, va, 1, 1);
+  pte = walk(pagetable, va, 0);
+  if(pte == 0)
+    panic("uvmguard");
+  *pte = PTE_GUARD;
+}
+
+#ifdef SUMCOPY
+// Map the kernel into a process's page table, so that the kernel
+// can run on it and copyin()/copyout() can let the MMU translate
+// user addresses. The process's kernel stack and the devices get
+// PTEs of their own (the PLIC as two 2-megabyte megapages); kernel
+// text and RAM share the kernel page table's subtree. None of the
+// mappings are PTE_U.
+// Returns 0 on success, -1 if out of memory.
+int
+kvmshare(pagetable_t pagetable, uint64 kstack)
+{
+  pte_t *pte;
+  pagetable_t l1;
+  uint64 a;
+
+  if(PX(2, KERNBASE) != PX(2, PHYSTOP-1))
+    panic("kvmshare: PHYSTOP");
+  if((pte = walk(kernel_pagetable, kstack, 0)) == 0 || (*pte & PTE_V) == 0)
+    panic("kvmshare: kstack");
+
+  if(mappages(pagetable, kstack, PGSIZE, PTE2PA(*pte), PTE_R | PTE_W) != 0 ||
+     mappages(pagetable, UART0, PGSIZE, UART0, PTE_R | PTE_W) != 0 ||
+     mappages(pagetable, VIRTIO0, NDISK*PGSIZE, VIRTIO0, PTE_R | PTE_W) != 0){
+    kvmunshare(pagetable);
+    return -1;
+  }
+
+  // mapping UART0 created the level-1 table that covers the PLIC.
+  l1 = (pagetable_t)PTE2PA(pagetable[PX(2, PLIC)]);
+  for(a = PLIC; a < PLIC + 0x400000; a += 1L << PXSHIFT(1))
+    l1[PX(1, a)] = PA2PTE(a) | PTE_R | PTE_W | PTE_V;
+
+  pagetable[PX(2, KERNBASE)] = kernel_pagetable[PX(2, KERNBASE)];
+  return 0;
+}
+
+// Remove what kvmshare() mapped, without freeing any of the
+// kernel's memory, so that freewalk() can free the page table.
+void
+kvmunshare(pagetable_t pagetable)
+{
+  pte_t *pte;
+  pagetable_t l1;
+  uint64 a;
+  int i;
+
+  pagetable[PX(2, KERNBASE)] = 0;
+
+  if(pagetable[PX(2, PLIC)] & PTE_V){
+    l1 = (pagetable_t)PTE2PA(pagetable[PX(2, PLIC)]);
+    for(a = PLIC; a < PLIC + 0x400000; a += 1L << PXSHIFT(1))
+      if(PTE_FLAGS(l1[PX(1, a)]) != PTE_V)
+        l1[PX(1, a)] = 0;
+  }
+
+  if((pte = walk(pagetable, UART0, 0)) != 0)
+    *pte = 0;
+  for(i = 0; i < NDISK; i++)
+    if((pte = walk(pagetable, VIRTIO(i), 0)) != 0)
+      *pte = 0;
+  for(i = 0; i < NPROC; i++)
+    if((pte = walk(pagetable, KSTACK(i), 0)) != 0)
+      *pte = 0;
+}
+
+// Is pagetable the one this hart is running on?
+// Then the MMU can translate its user addresses.
+static int
+ismapped(pagetable_t pagetable)
+{
+  return (r_satp() & ~(SATP_ASID_MASK << SATP_ASID_SHIFT)) == MAKE_SATP(pagetable);
+}
+#endif
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -353,10 +465,20 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
 
+#ifdef SUMCOPY
+  if(ismapped(pagetable)){
+    if(dstva >= MAXUVA || len > MAXUVA - dstva)
+      return -1;
+    if(copyuser((char *)dstva, src, len) == 0)
+      return 0;
+    // perhaps a page is in swap; take the slow path.
+  }
+#endif
+
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = swapin(pagetable, va0)) == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
     if(n > len)
@@ -378,10 +500,19 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+#ifdef SUMCOPY
+  if(ismapped(pagetable)){
+    if(srcva >= MAXUVA || len > MAXUVA - srcva)
+      return -1;
+    if(copyuser(dst, (char *)srcva, len) == 0)
+      return 0;
+  }
+#endif
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = swapin(pagetable, va0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -405,10 +536,21 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+#ifdef SUMCOPY
+  if(ismapped(pagetable)){
+    if(srcva >= MAXUVA)
+      return -1;
+    if(max > MAXUVA - srcva)
+      max = MAXUVA - srcva;
+    if(copyuserstr(dst, (char *)srcva, max) == 0)
+      return 0;
+  }
+#endif
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = swapin(pagetable, va0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
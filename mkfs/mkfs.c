@@ -16,15 +16,18 @@
 #endif
 
 #define NINODES 200
+#define NENT    NINODES  // most files in the root directory
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | free bit map | data blocks | swap ]
 
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
+int fssize = FSSIZE;  // Size of file system (blocks)
+int nbitmap;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = 4*LOGSIZE+1;  // journal superblock and records
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
+int nswapblocks = NSWAP * (4096 / BSIZE);
 
 int fsfd;
 struct superblock sb;
@@ -40,6 +43,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void rootdir(uint rootino, struct dirent *de, int n);
 void die(const char *);
 
 // convert to riscv byte order
@@ -69,45 +73,71 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
+  struct dirent de[NENT];
+  int nde;
   char buf[BSIZE];
   struct dinode din;
+  off_t size;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  while(argc >= 3 && (strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "-l") == 0)){
+    if(argv[1][1] == 's')
+      fssize = atoi(argv[2]);
+    else
+      nlog = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-s blocks] [-l logblocks] fs.img files...\n");
+    exit(1);
+  }
+  // the kernel needs room for a record of three FS calls'
+  // blocks, plus the journal superblock.
+  if(nlog < 3*MAXOPBLOCKS+MAXDESC+1){
+    fprintf(stderr, "mkfs: log must be at least %d blocks\n", (int)(3*MAXOPBLOCKS+MAXDESC+1));
     exit(1);
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert((4096 % BSIZE) == 0);   // swap pages are whole blocks
+  assert(sizeof(struct superblock) <= BSIZE);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0)
     die(argv[1]);
 
   // 1 fs block = 1 disk sector
+  nbitmap = fssize/(BSIZE*8) + 1;
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  if(fssize <= nmeta){
+    fprintf(stderr, "mkfs: file system of %d blocks is too small\n", fssize);
+    exit(1);
+  }
+  nblocks = fssize - nmeta;
 
   sb.magic = FSMAGIC;
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
   sb.ninodes = xint(NINODES);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.swapstart = xint(fssize);
+  sb.nswap = xint(NSWAP);
+  sb.bsize = xint(BSIZE);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d swap blocks %d block size %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize, nswapblocks, BSIZE);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  for(i = 0; i < fssize + nswapblocks; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -117,16 +147,7 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
-
+  nde = 0;
   for(i = 2; i < argc; i++){
     // get rid of "user/"
     char *shortname;
@@ -149,26 +170,39 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    assert(nde < NENT);
+    bzero(&de[nde], sizeof(de[nde]));
+    de[nde].inum = xshort(inum);
+    strncpy(de[nde].name, shortname, DIRSIZ);
+    nde++;
 
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
+    // a small file's data goes in its inode's addrs[].
+    if((size = lseek(fd, 0, SEEK_END)) < 0 || lseek(fd, 0, SEEK_SET) < 0)
+      die(argv[i]);
+    if(size <= NINLINE){
+      rinode(inum, &din);
+      if((cc = read(fd, din.addrs, size)) != size)
+        die(argv[i]);
+      din.size = xint(cc);
+      winode(inum, &din);
+    } else {
+      while((cc = read(fd, buf, sizeof(buf))) > 0)
+        iappend(inum, buf, cc);
+    }
 
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  rootdir(rootino, de, nde);
 
   balloc(freeblock);
 
+  // record the free block count.
+  sb.nfree = xint(fssize - freeblock);
+  memset(buf, 0, sizeof(buf));
+  memmove(buf, &sb, sizeof(sb));
+  wsect(1, buf);
+
   exit(0);
 }
 
@@ -249,6 +283,20 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// return entry i of indirect block bno, allocating it if need be.
+uint
+indirect1(uint bno, uint i)
+{
+  uint indirect[NINDIRECT];
+
+  rsect(bno, (char*)indirect);
+  if(indirect[i] == 0){
+    indirect[i] = xint(freeblock++);
+    wsect(bno, (char*)indirect);
+  }
+  return xint(indirect[i]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,7 +304,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -270,16 +317,18 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      x = indirect1(xint(din.addrs[NDIRECT]), fbn - NDIRECT);
+    } else {
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
       }
-      x = xint(indirect[fbn-NDIRECT]);
+      x = fbn - NDIRECT - NINDIRECT;
+      x = indirect1(indirect1(xint(din.addrs[NDIRECT+1]), x / NINDIRECT),
+                    x % NINDIRECT);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -299,3 +348,53 @@ die(const char *s)
   perror(s);
   exit(1);
 }
+
+// Write the root directory in the indexed format fs.c expects:
+// a header block holding "." and ".." and the hash table, then
+// one bucket per table slot, using the smallest table in which
+// no bucket overflows.
+void
+rootdir(uint rootino, struct dirent *de, int n)
+{
+  char blk[BSIZE];
+  struct dirent *bde;
+  int depth, fill[DIRMAXTABLE];
+  int j, k, b;
+  uint mask;
+
+  for(depth = 0; ; depth++){
+    assert((1 << depth) <= DIRMAXTABLE);
+    mask = (1 << depth) - 1;
+    memset(fill, 0, sizeof(fill));
+    for(k = 0; k < n; k++)
+      if(++fill[dirhash(de[k].name) & mask] > DPB - 1)
+        break;
+    if(k == n)
+      break;
+  }
+
+  bzero(blk, sizeof(blk));
+  bde = (struct dirent*)blk;
+  bde[0].inum = xshort(rootino);
+  strcpy(bde[0].name, ".");
+  bde[1].inum = xshort(rootino);
+  strcpy(bde[1].name, "..");
+  DIRHDR(blk, DIRH_DEPTH) = depth;
+  for(b = 0; b < 4; b++)
+    DIRHDR(blk, DIRH_COUNT + b) = n >> (8*b);
+  for(j = 0; j <= mask; j++){
+    DIRHDR(blk, DIRH_TABLE + 2*j) = (j + 1);
+    DIRHDR(blk, DIRH_TABLE + 2*j + 1) = (j + 1) >> 8;
+  }
+  iappend(rootino, blk, BSIZE);
+
+  for(j = 0; j <= mask; j++){
+    bzero(blk, sizeof(blk));
+    DIRBDEPTH(blk) = depth;
+    b = 1;
+    for(k = 0; k < n; k++)
+      if((dirhash(de[k].name) & mask) == j)
+        bde[b++] = de[k];
+    iappend(rootino, blk, BSIZE);
+  }
+}
@@ -2,13 +2,28 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 
+#define SENDMAX (1024*1024)  // most bytes to ask sendfile() for
+
 char buf[512];
 
+// Copy fd to the standard output. Unless that's the console,
+// the kernel can move the data itself with sendfile().
 void
 cat(int fd)
 {
+  struct stat st;
   int n;
 
+  // fstat() fails for a pipe.
+  if(fstat(1, &st) < 0 || st.type != T_DEVICE){
+    while((n = sendfile(1, fd, SENDMAX)) > 0)
+      ;
+    if(n == 0)
+      return;
+    // not a pair sendfile() handles, or an error,
+    // which the loop below will report.
+  }
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       fprintf(2, "cat: write error\n");
@@ -0,0 +1,29 @@
+// Print the kernel's directory entry cache counters, optionally
+// after looking up each of the named paths.
+//
+// usage: dcstat [path...]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  uint st[3], total;
+  struct stat s;
+  int i;
+
+  for(i = 1; i < argc; i++)
+    stat(argv[i], &s);
+  if(dcachestat(st) < 0){
+    fprintf(2, "dcstat: dcachestat failed\n");
+    exit(1);
+  }
+  total = st[0] + st[1] + st[2];
+  printf("dcache: %d hits, %d negative hits, %d misses", st[0], st[1], st[2]);
+  if(total)
+    printf(", %d%% hit rate", (st[0] + st[1]) * 100 / total);
+  printf("\n");
+  exit(0);
+}
@@ -3,11 +3,13 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 
+#define NENT 16 // entries per getdents()
+
 void find(char *path, char *filename)
 {
     char buf[512], *p;
-    int fd;
-    struct dirent de;
+    int fd, i, n;
+    struct dent ents[NENT], *de;
     struct stat st;
 
     if ((fd = open(path, 0)) < 0)
@@ -40,26 +42,24 @@ void find(char *path, char *filename)
         strcpy(buf, path);
         p = buf + strlen(buf);
         *p++ = '/';
-        while (read(fd, &de, sizeof(de)) == sizeof(de))
+        while ((n = getdents(fd, ents, NENT)) > 0)
         {
-            if (de.inum == 0 || strcmp(de.name, ".") == 0 || strcmp(de.name, "..") == 0)
-                // ignore item with inum = 0 / . / ..
-                continue;
-            
-            memmove(p, de.name, DIRSIZ);
-            p[DIRSIZ] = 0;
-            if (stat(buf, &st) < 0)
-            {
-                printf("find: cannot stat %s\n", buf);
-                continue;
-            }
-            if (st.type == T_FILE && strcmp(de.name, filename) == 0)
+            for (i = 0; i < n; i++)
             {
-                printf("%s\n", buf);
-            }
-            else if (st.type == T_DIR)
-            {
-                find(buf, filename);
+                de = &ents[i];
+                if (strcmp(de->name, ".") == 0 || strcmp(de->name, "..") == 0)
+                    // ignore . / ..
+                    continue;
+
+                strcpy(p, de->name);
+                if (de->type == T_FILE && strcmp(de->name, filename) == 0)
+                {
+                    printf("%s\n", buf);
+                }
+                else if (de->type == T_DIR)
+                {
+                    find(buf, filename);
+                }
             }
         }
 
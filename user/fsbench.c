@@ -0,0 +1,113 @@
+// Measure file system throughput: write a file sequentially,
+// read it back, then create and delete a batch of small files.
+// Build with "make BSIZE=1024" or "make BSIZE=4096" (after
+// "make clean") to compare block sizes.
+//
+// usage: fsbench [kilobytes]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define CHUNK  8192  // bytes per read or write
+#define NSMALL 100   // small files to create
+
+char buf[CHUNK];
+
+void
+rate(char *what, int kb, int ticks)
+{
+  if(ticks == 0)
+    ticks = 1;
+  printf("fsbench: %s %d KB: %d ticks, %d KB/tick\n", what, kb, ticks, kb / ticks);
+}
+
+void
+seqwrite(int kb)
+{
+  int fd, i, t0;
+
+  unlink("fsbench.tmp");
+  if((fd = open("fsbench.tmp", O_CREATE|O_WRONLY)) < 0){
+    fprintf(2, "fsbench: cannot create fsbench.tmp\n");
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < kb * 1024 / CHUNK; i++){
+    buf[0] = i;
+    if(write(fd, buf, CHUNK) != CHUNK){
+      fprintf(2, "fsbench: write failed\n");
+      exit(1);
+    }
+  }
+  // count the time to write it out, too.
+  fsync(fd);
+  close(fd);
+  rate("sequential write", kb, uptime() - t0);
+}
+
+void
+seqread(int kb)
+{
+  int fd, i, t0;
+
+  if((fd = open("fsbench.tmp", O_RDONLY)) < 0){
+    fprintf(2, "fsbench: cannot open fsbench.tmp\n");
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < kb * 1024 / CHUNK; i++){
+    if(read(fd, buf, CHUNK) != CHUNK || buf[0] != (char)i){
+      fprintf(2, "fsbench: read failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+  rate("sequential read", kb, uptime() - t0);
+  unlink("fsbench.tmp");
+}
+
+void
+smallfiles(void)
+{
+  char name[16];
+  int fd, i, t0;
+
+  t0 = uptime();
+  for(i = 0; i < NSMALL; i++){
+    name[0] = 'f';
+    name[1] = 'b';
+    name[2] = '0' + i / 10;
+    name[3] = '0' + i % 10;
+    name[4] = 0;
+    if((fd = open(name, O_CREATE|O_WRONLY)) < 0 || write(fd, buf, 100) != 100){
+      fprintf(2, "fsbench: cannot create %s\n", name);
+      exit(1);
+    }
+    close(fd);
+  }
+  for(i = 0; i < NSMALL; i++){
+    name[2] = '0' + i / 10;
+    name[3] = '0' + i % 10;
+    unlink(name);
+  }
+  printf("fsbench: create+unlink %d small files: %d ticks\n", NSMALL, uptime() - t0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int kb = 4096;
+
+  if(argc > 1)
+    kb = atoi(argv[1]);
+  if(kb < CHUNK / 1024)
+    kb = CHUNK / 1024;
+  printf("fsbench: block size %d\n", BSIZE);
+  seqwrite(kb);
+  seqread(kb);
+  smallfiles();
+  exit(0);
+}
@@ -0,0 +1,118 @@
+// Compare the kernel's disk scheduling policies: under each one,
+// several processes read their own files while another writes
+// and fsyncs, and the disk request latencies are reported.
+//
+// usage: iobench [kilobytes]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/iosched.h"
+#include "user/user.h"
+
+#define NREADER 3
+#define CHUNK   4096
+
+char *policies[NIOSCHED] = {
+[IOS_FIFO]     "fifo",
+[IOS_ELEVATOR] "elevator",
+[IOS_DEADLINE] "deadline",
+};
+
+char buf[CHUNK];
+
+char*
+fname(int i)
+{
+  static char name[] = "iob.0";
+
+  name[4] = '0' + i;
+  return name;
+}
+
+void
+mkfile(char *name, int kb)
+{
+  int fd, i;
+
+  if((fd = open(name, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    fprintf(2, "iobench: cannot create %s\n", name);
+    exit(1);
+  }
+  for(i = 0; i < kb * 1024 / CHUNK; i++){
+    if(write(fd, buf, CHUNK) != CHUNK){
+      fprintf(2, "iobench: write %s failed\n", name);
+      exit(1);
+    }
+    // the writer pushes its data out as it goes.
+    if(i % 8 == 7)
+      fsync(fd);
+  }
+  fsync(fd);
+  close(fd);
+}
+
+void
+readfile(char *name)
+{
+  int fd;
+
+  if((fd = open(name, O_RDONLY)) < 0){
+    fprintf(2, "iobench: cannot open %s\n", name);
+    exit(1);
+  }
+  while(read(fd, buf, CHUNK) > 0)
+    ;
+  close(fd);
+}
+
+void
+run(int policy, int kb)
+{
+  struct iostat st;
+  int i, t0;
+
+  iosched(policy);
+  t0 = uptime();
+  for(i = 0; i <= NREADER; i++){
+    if(fork() == 0){
+      if(i < NREADER)
+        readfile(fname(i));
+      else
+        mkfile(fname(NREADER), kb);
+      exit(0);
+    }
+  }
+  for(i = 0; i <= NREADER; i++)
+    wait(0);
+  iostat(&st);
+  printf("%s: %d ticks\n", policies[policy], uptime() - t0);
+  for(i = 0; i < 2; i++){
+    if(st.n[i] == 0)
+      continue;
+    printf("  %s: %d requests, avg wait %l us, avg latency %l us, max %l us\n",
+           i ? "writes" : "reads", st.n[i], st.wait[i] / st.n[i],
+           st.lat[i] / st.n[i], st.max[i]);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int kb = 512;
+  int i, old;
+
+  if(argc > 1)
+    kb = atoi(argv[1]);
+  for(i = 0; i < NREADER; i++)
+    mkfile(fname(i), kb);
+
+  old = iosched(IOS_FIFO);
+  for(i = 0; i < NIOSCHED; i++)
+    run(i, kb);
+  iosched(old);
+
+  for(i = 0; i <= NREADER; i++)
+    unlink(fname(i));
+  exit(0);
+}
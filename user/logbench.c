@@ -0,0 +1,69 @@
+// Measure how many log commits large sequential writes take:
+// write a file with write()s of several sizes, and report the
+// time, the commits per megabyte, the blocks written to the
+// log and, as file data, in place, and the checkpoints and the
+// blocks they installed. The log's size comes from mkfs;
+// "make clean; make NLOG=40 qemu" runs with 36-block
+// transactions and a checkpoint at every commit for comparison,
+// and "make LOGDATA=1" journals file data as well.
+//
+// usage: logbench [kilobytes]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define MAXCHUNK (64*1024)
+
+char buf[MAXCHUNK];
+
+int chunks[] = { 1024, 8192, 65536 };
+
+void
+run(int kb, int chunk)
+{
+  uint st0[7], st1[7];
+  int fd, i, n, t0, t;
+
+  unlink("logbench.tmp");
+  if((fd = open("logbench.tmp", O_CREATE|O_WRONLY)) < 0){
+    fprintf(2, "logbench: cannot create logbench.tmp\n");
+    exit(1);
+  }
+  n = kb * 1024 / chunk;
+  logstat(st0);
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    if(write(fd, buf, chunk) != chunk){
+      fprintf(2, "logbench: write failed\n");
+      exit(1);
+    }
+  }
+  fsync(fd);
+  t = uptime() - t0;
+  logstat(st1);
+  close(fd);
+  unlink("logbench.tmp");
+  printf("logbench: %d KB in %d-byte writes: %d ticks, %d commits (%d/MB), %d blocks logged, %d in place, %d checkpoints installing %d blocks\n",
+         kb, chunk, t, st1[0] - st0[0], (st1[0] - st0[0]) * 1024 / kb,
+         st1[1] - st0[1], st1[4] - st0[4], st1[5] - st0[5], st1[6] - st0[6]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint st[7];
+  int kb = 2048;
+  int i;
+
+  if(argc > 1)
+    kb = atoi(argv[1]);
+  if(kb < MAXCHUNK / 1024)
+    kb = MAXCHUNK / 1024;
+  logstat(st);
+  printf("logbench: %d-block transactions, %d blocks per system call\n", st[2], st[3]);
+  for(i = 0; i < sizeof(chunks)/sizeof(chunks[0]); i++)
+    run(kb, chunks[i]);
+  exit(0);
+}
@@ -3,6 +3,10 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 
+#define NENT 32  // entries per getdents()
+
+struct dent ents[NENT];
+
 char*
 fmtname(char *path)
 {
@@ -25,9 +29,7 @@ fmtname(char *path)
 void
 ls(char *path)
 {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, i, n;
   struct stat st;
 
   if((fd = open(path, 0)) < 0){
@@ -48,24 +50,12 @@ ls(char *path)
     break;
 
   case T_DIR:
-    if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
-      printf("ls: path too long\n");
-      break;
-    }
-    strcpy(buf, path);
-    p = buf+strlen(buf);
-    *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf("ls: cannot stat %s\n", buf);
-        continue;
-      }
-      printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
+    while((n = getdents(fd, ents, NENT)) > 0){
+      for(i = 0; i < n; i++)
+        printf("%s %d %d %d\n", fmtname(ents[i].name), ents[i].type, ents[i].ino, ents[i].size);
     }
+    if(n < 0)
+      fprintf(2, "ls: cannot read %s\n", path);
     break;
   }
   close(fd);
@@ -0,0 +1,108 @@
+// Stress the kernel's physical page allocator: several processes
+// grow and shrink their memory by random amounts, touching every
+// page, so that pages are split off and coalesced back into larger
+// blocks over and over. Reports free memory and fragmentation
+// before and after, and how long the churn took.
+//
+// usage: memstress [rounds]
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NCHILD   4
+#define MAXGROW  64   // most pages to add in one step
+
+static unsigned long seed;
+
+int
+rnd(int n)
+{
+  seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+  return (seed >> 33) % n;
+}
+
+void
+report(char *when)
+{
+  int nfree[MAXORDER+1];
+  int k, total, big, largest;
+
+  if(memstat(nfree) < 0){
+    fprintf(2, "memstress: memstat failed\n");
+    exit(1);
+  }
+  total = 0;
+  largest = -1;
+  for(k = 0; k <= MAXORDER; k++){
+    total += nfree[k] << k;
+    if(nfree[k])
+      largest = k;
+  }
+  // share of free memory that can't satisfy a 16-page request.
+  big = 0;
+  for(k = 4; k <= MAXORDER; k++)
+    big += nfree[k] << k;
+  printf("memstress: %s: %d free pages, largest block 2^%d, %d%% unusable for 2^4\n",
+         when, total, largest, total ? 100 - big * 100 / total : 0);
+  printf("memstress: %s: free blocks by order:", when);
+  for(k = 0; k <= MAXORDER; k++)
+    printf(" %d", nfree[k]);
+  printf("\n");
+}
+
+void
+churn(int rounds)
+{
+  int i, n, grown;
+  char *p, *q;
+
+  grown = 0;
+  for(i = 0; i < rounds; i++){
+    if(grown == 0 || rnd(2)){
+      n = 1 + rnd(MAXGROW);
+      if((p = sbrk(n * PGSIZE)) == (char*)-1)
+        continue;
+      for(q = p; q < p + n * PGSIZE; q += PGSIZE)
+        *q = i;
+      grown += n;
+    } else {
+      n = 1 + rnd(grown);
+      sbrk(-n * PGSIZE);
+      grown -= n;
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = 2000;
+  int i, pid, t0;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+
+  report("before");
+  t0 = uptime();
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "memstress: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      seed = getpid();
+      churn(rounds);
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++)
+    wait(0);
+  printf("memstress: %d processes x %d rounds: %d ticks\n",
+         NCHILD, rounds, uptime() - t0);
+  report("after");
+  exit(0);
+}
@@ -0,0 +1,19 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// mount the file system on disk dev (2 is the second
+// virtio disk) on the empty directory dir.
+int
+main(int argc, char *argv[])
+{
+  if(argc != 3){
+    fprintf(2, "Usage: mount dev dir\n");
+    exit(1);
+  }
+  if(mount(atoi(argv[1]), argv[2]) < 0){
+    fprintf(2, "mount %s %s: failed\n", argv[1], argv[2]);
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,80 @@
+// Compare waiting for disk interrupts with polling for
+// completions: read a file too big for the buffer cache
+// under each mode and report the disk read latencies.
+//
+// usage: pollbench [kilobytes]
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/iosched.h"
+#include "user/user.h"
+
+#define CHUNK 4096
+
+struct {
+  char *name;
+  int mode;
+  int usec;  // most time to poll
+} runs[] = {
+  { "interrupts",   DISKPOLL_OFF,   0 },
+  { "poll 20us",    DISKPOLL_READS, 20 },
+  { "poll 100us",   DISKPOLL_READS, 100 },
+  { "poll 1000us",  DISKPOLL_READS, 1000 },
+};
+
+char buf[CHUNK];
+
+void
+run(int i, int kb)
+{
+  struct iostat st;
+  int fd, t0, n;
+
+  diskpoll(runs[i].mode, runs[i].usec);
+  iostat(&st);
+  iosched(st.policy);  // clear the counts
+  t0 = uptime();
+  if((fd = open("pollbench.tmp", O_RDONLY)) < 0){
+    fprintf(2, "pollbench: cannot open pollbench.tmp\n");
+    exit(1);
+  }
+  while(read(fd, buf, CHUNK) > 0)
+    ;
+  close(fd);
+  n = uptime() - t0;
+  iostat(&st);
+  printf("pollbench: %s: %d KB in %d ticks, %d reads, avg latency %l us, max %l us\n",
+         runs[i].name, kb, n, st.n[0], st.n[0] ? st.lat[0] / st.n[0] : 0, st.max[0]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int kb = 1024;
+  int fd, i, old;
+
+  if(argc > 1)
+    kb = atoi(argv[1]);
+
+  if((fd = open("pollbench.tmp", O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    fprintf(2, "pollbench: cannot create pollbench.tmp\n");
+    exit(1);
+  }
+  for(i = 0; i < kb * 1024 / CHUNK; i++){
+    if(write(fd, buf, CHUNK) != CHUNK){
+      fprintf(2, "pollbench: write failed\n");
+      exit(1);
+    }
+  }
+  fsync(fd);
+  close(fd);
+
+  old = diskpoll(DISKPOLL_OFF, -1);
+  for(i = 0; i < sizeof(runs)/sizeof(runs[0]); i++)
+    run(i, kb);
+  diskpoll(old, POLLUSEC);
+  unlink("pollbench.tmp");
+  exit(0);
+}
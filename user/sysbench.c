@@ -0,0 +1,70 @@
+// Measure the cost of crossing between user space and the kernel:
+// a tight loop of getpid() system calls, and a one-byte pipe
+// ping-pong between two processes, which adds context switches.
+//
+// usage: sysbench [rounds]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+void
+syscalls(int n)
+{
+  int i, t0;
+
+  t0 = uptime();
+  for(i = 0; i < n; i++)
+    getpid();
+  printf("sysbench: %d getpid calls: %d ticks\n", n, uptime() - t0);
+}
+
+void
+pingpong(int n)
+{
+  int p1[2], p2[2], i, pid, t0;
+  char c = 'x';
+
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    fprintf(2, "sysbench: pipe failed\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "sysbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p1[1]);
+    close(p2[0]);
+    while(read(p1[0], &c, 1) == 1)
+      write(p2[1], &c, 1);
+    exit(0);
+  }
+  close(p1[0]);
+  close(p2[1]);
+  for(i = 0; i < n; i++){
+    if(write(p1[1], &c, 1) != 1 || read(p2[0], &c, 1) != 1){
+      fprintf(2, "sysbench: ping-pong failed\n");
+      exit(1);
+    }
+  }
+  close(p1[1]);
+  close(p2[0]);
+  wait(0);
+  printf("sysbench: %d pipe round trips: %d ticks\n", n, uptime() - t0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100000;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  syscalls(n);
+  pingpong(n / 10);
+  exit(0);
+}
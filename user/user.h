@@ -1,4 +1,7 @@
 struct stat;
+struct dent;
+struct iostat;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -22,6 +25,21 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int memstat(int*);
+int dcachestat(uint*);
+int getdents(int, struct dent*, int);
+int fsync(int);
+int iosched(int);
+int iostat(struct iostat*);
+int diskpoll(int, int);
+int mount(int, const char*);
+int logstat(uint*);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int lseek(int, int, int);
+int sendfile(int, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
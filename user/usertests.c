@@ -575,6 +575,10 @@ writetest(char *s)
   }
 }
 
+// blocks in writebig's file: MAXFILE if the file system has
+// room, else still enough to need the doubly-indirect block.
+#define BIGBLOCKS (MAXFILE < FSSIZE/2 ? MAXFILE : FSSIZE/2)
+
 void
 writebig(char *s)
 {
@@ -586,7 +590,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +610,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGBLOCKS){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -1778,6 +1782,359 @@ bigfile(char *s)
   unlink("bigfile.dat");
 }
 
+// grow a small file, whose data is kept in its inode, with a
+// write that crosses into a second block. the first block gets
+// a disk address at once while the second may be delayed, and
+// the size committed meanwhile must not make the file look
+// small again (iupdate() panics if it would).
+void
+spillwrite(char *s)
+{
+  enum { N = BSIZE + 100 };
+  struct stat st;
+  int fd, i;
+
+  for(i = 0; i < N; i++)
+    buf[i] = 'a' + i % 23;
+  unlink("spill");
+  fd = open("spill", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, 20) != 20){
+    printf("%s: create spill failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, buf + 10, N - 10, 10) != N - 10){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.size != N){
+    printf("%s: size %d, not %d\n", s, (int)st.size, N);
+    exit(1);
+  }
+  if(fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("spill", O_RDONLY);
+  if(fd < 0 || read(fd, buf + N, N + 1) != N || memcmp(buf, buf + N, N) != 0){
+    printf("%s: read back wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("spill");
+}
+
+// pread() and pwrite() use their own offset and leave
+// the file's alone.
+void
+preadwrite(char *s)
+{
+  char b[16];
+  int fd, fds[2];
+
+  unlink("prw");
+  fd = open("prw", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "0123456789", 10) != 10){
+    printf("%s: create prw failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "ab", 2, 3) != 2){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  // the offset is still at the end.
+  if(write(fd, "X", 1) != 1){
+    printf("%s: write after pwrite failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, sizeof(b), 0) != 11 || memcmp(b, "012ab56789X", 11) != 0){
+    printf("%s: pread saw wrong data\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, 4, 2) != 4 || memcmp(b, "2ab5", 4) != 0){
+    printf("%s: pread at 2 saw wrong data\n", s);
+    exit(1);
+  }
+  if(read(fd, b, sizeof(b)) != 0){
+    printf("%s: pread moved the offset\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, 4, 20) != 0){
+    printf("%s: pread past the end returned data\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "x", 1, 20) != -1){
+    printf("%s: pwrite past the end succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("prw");
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fds[1], "x", 1, 0) != -1 || pread(fds[0], b, 1, 0) != -1){
+    printf("%s: pread/pwrite on a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void
+lseektest(char *s)
+{
+  char b[4];
+  int fd, fds[2];
+
+  unlink("lseek");
+  fd = open("lseek", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "0123456789", 10) != 10){
+    printf("%s: create lseek failed\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 0, SEEK_END) != 10 || lseek(fd, -4, SEEK_END) != 6){
+    printf("%s: lseek SEEK_END failed\n", s);
+    exit(1);
+  }
+  if(read(fd, b, 4) != 4 || memcmp(b, "6789", 4) != 0){
+    printf("%s: read after lseek saw wrong data\n", s);
+    exit(1);
+  }
+  if(lseek(fd, -2, SEEK_CUR) != 8 || lseek(fd, 0, SEEK_SET) != 0){
+    printf("%s: lseek SEEK_CUR/SEEK_SET failed\n", s);
+    exit(1);
+  }
+  if(lseek(fd, -1, SEEK_SET) != -1 || lseek(fd, -11, SEEK_END) != -1){
+    printf("%s: lseek to a negative offset succeeded\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 1, SEEK_END) != -1 || lseek(fd, 0, 3) != -1){
+    printf("%s: lseek past the end or with a bad whence succeeded\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 0, SEEK_CUR) != 0){
+    printf("%s: failed lseek moved the offset\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("lseek");
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(lseek(fds[0], 0, SEEK_SET) != -1){
+    printf("%s: lseek on a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// a readv() that reaches the end of the file stops there.
+void
+readvtest(char *s)
+{
+  char a[4], b[4], c[8];
+  struct iovec iov[3];
+  int fd;
+
+  unlink("readv");
+  fd = open("readv", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "0123456789", 10) != 10){
+    printf("%s: create readv failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("readv", O_RDONLY);
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  iov[2].iov_base = c;
+  iov[2].iov_len = sizeof(c);
+  if(readv(fd, iov, 3) != 10){
+    printf("%s: short readv didn't return 10\n", s);
+    exit(1);
+  }
+  if(memcmp(a, "0123", 4) != 0 || memcmp(b, "4567", 4) != 0 || memcmp(c, "89", 2) != 0){
+    printf("%s: readv saw wrong data\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, 3) != 0){
+    printf("%s: readv at the end returned data\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, IOV_MAX + 1) != -1){
+    printf("%s: readv of too many buffers succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("readv");
+}
+
+// a writev() too big for one log transaction.
+void
+writevtest(char *s)
+{
+  struct iovec iov[IOV_MAX];
+  uint st[7];
+  char b[512];
+  int fd, i, j, k, m, n, tot, max, len;
+
+  if(logstat(st) < 0){
+    printf("%s: logstat failed\n", s);
+    exit(1);
+  }
+  // as in filewritev().
+  max = ((st[3]-1-2-1-2) / 2) * BSIZE;
+  len = BUFSZ - 16;
+  n = max / len + 2;
+  if(n > IOV_MAX){
+    printf("%s: log too big to test\n", s);
+    return;
+  }
+  for(i = 0; i < BUFSZ; i++)
+    buf[i] = i % 251;
+  // each buffer starts at a different byte of the pattern.
+  tot = 0;
+  for(i = 0; i < n; i++){
+    iov[i].iov_base = buf + i;
+    iov[i].iov_len = len;
+    tot += len;
+  }
+
+  unlink("writev");
+  fd = open("writev", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create writev failed\n", s);
+    exit(1);
+  }
+  if(writev(fd, iov, n) != tot){
+    printf("%s: writev of %d bytes failed\n", s, tot);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("writev", O_RDONLY);
+  for(i = 0; i < n; i++){
+    for(j = 0; j < len; j += m){
+      m = len - j < sizeof(b) ? len - j : sizeof(b);
+      if(read(fd, b, m) != m){
+        printf("%s: short read of writev\n", s);
+        exit(1);
+      }
+      for(k = 0; k < m; k++){
+        if(b[k] != (char)((i + j + k) % 251)){
+          printf("%s: writev wrote wrong data in buffer %d\n", s, i);
+          exit(1);
+        }
+      }
+    }
+  }
+  if(read(fd, b, 1) != 0){
+    printf("%s: writev wrote too much\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("writev");
+}
+
+// sendfile() between files and pipes, and the pairs it refuses.
+void
+sendfiletest(char *s)
+{
+  enum { SZ = 3*BSIZE + 100 };
+  char b[300];
+  int src, dst, fds[2], i, n;
+
+  for(i = 0; i < SZ; i++)
+    buf[i] = i % 253;
+  unlink("sf.src");
+  unlink("sf.dst");
+  src = open("sf.src", O_CREATE|O_RDWR);
+  if(src < 0 || write(src, buf, SZ) != SZ){
+    printf("%s: create sf.src failed\n", s);
+    exit(1);
+  }
+  close(src);
+
+  // file to file.
+  src = open("sf.src", O_RDONLY);
+  dst = open("sf.dst", O_CREATE|O_RDWR);
+  if(src < 0 || dst < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if((n = sendfile(dst, src, SZ + 1000)) != SZ){
+    printf("%s: sendfile file to file moved %d, not %d\n", s, n, SZ);
+    exit(1);
+  }
+  if(sendfile(dst, src, 10) != 0){
+    printf("%s: sendfile at the end moved data\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i += sizeof(b)){
+    n = SZ - i < sizeof(b) ? SZ - i : sizeof(b);
+    if(pread(dst, b, n, i) != n || memcmp(b, buf + i, n) != 0){
+      printf("%s: sendfile file to file wrote wrong data\n", s);
+      exit(1);
+    }
+  }
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+
+  // file to pipe, less than the pipe holds.
+  if(lseek(src, 100, SEEK_SET) != 100 || sendfile(fds[1], src, sizeof(b)) != sizeof(b)){
+    printf("%s: sendfile file to pipe failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], b, sizeof(b)) != sizeof(b) || memcmp(b, buf + 100, sizeof(b)) != 0){
+    printf("%s: sendfile file to pipe sent wrong data\n", s);
+    exit(1);
+  }
+
+  // pipe to file: moves what the pipe has.
+  if(write(fds[1], buf + 500, 200) != 200 || lseek(dst, 0, SEEK_SET) != 0){
+    printf("%s: write to pipe failed\n", s);
+    exit(1);
+  }
+  if((n = sendfile(dst, fds[0], sizeof(b))) != 200){
+    printf("%s: sendfile pipe to file moved %d, not 200\n", s, n);
+    exit(1);
+  }
+  if(lseek(dst, 0, SEEK_CUR) != 200 || pread(dst, b, 200, 0) != 200 ||
+     memcmp(b, buf + 500, 200) != 0){
+    printf("%s: sendfile pipe to file wrote wrong data\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  close(dst);
+
+  // not to the console, nor from a file to itself.
+  if(sendfile(1, src, 10) != -1){
+    printf("%s: sendfile to the console succeeded\n", s);
+    exit(1);
+  }
+  dst = open("sf.src", O_WRONLY);
+  if(sendfile(dst, src, 10) != -1){
+    printf("%s: sendfile to the same file succeeded\n", s);
+    exit(1);
+  }
+  close(dst);
+  close(src);
+  unlink("sf.src");
+  unlink("sf.dst");
+}
+
 void
 fourteen(char *s)
 {
@@ -2613,6 +2970,12 @@ struct test {
   {subdir, "subdir"},
   {bigwrite, "bigwrite"},
   {bigfile, "bigfile"},
+  {spillwrite, "spillwrite"},
+  {preadwrite, "preadwrite"},
+  {lseektest, "lseektest"},
+  {readvtest, "readvtest"},
+  {writevtest, "writevtest"},
+  {sendfiletest, "sendfiletest"},
   {fourteen, "fourteen"},
   {rmdot, "rmdot"},
   {dirfile, "dirfile"},
@@ -2837,7 +3200,7 @@ diskfull(char *s)
       break;
     }
     for(int i = 0; i < MAXFILE; i++){
-      char buf[BSIZE];
+      static char buf[BSIZE];
       if(write(fd, buf, BSIZE) != BSIZE){
         done = 1;
         close(fd);
@@ -36,3 +36,18 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("memstat");
+entry("dcachestat");
+entry("getdents");
+entry("fsync");
+entry("iosched");
+entry("iostat");
+entry("diskpoll");
+entry("mount");
+entry("logstat");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("lseek");
+entry("sendfile");